@@ -0,0 +1,657 @@
+#ifndef ADJACENCY_H
+#define ADJACENCY_H
+
+#include <vector>
+#include <list>
+#include <deque>
+#include <type_traits>
+#include <algorithm>
+#include <stdint.h>
+#include <string.h>
+#include "HugePages.cpp"
+using namespace std;
+
+// Storage of the edges of one direction of a graph, by internal index
+// The storages of the graph (ListAdjacency and CompressedAdjacency) offer the
+// same interface, so the graph algorithms are written once as templates over
+// it:
+//   addVertex(), add(u, w), removeAll(u, w), count(u, w), degree(u),
+//   forEach(u, f), cursor(u) / next(cursor, w), prepare(), relabel(),
+//   memoryBytes()
+// The SCC kernel (SccKernel.cpp) only needs cursor() and next(), so the
+// storages that are built once and then only traversed (CsrAdjacency,
+// BitMatrixAdjacency) offer addVertex(), add(), prepare(), degree(),
+// forEach(), cursor() / next() and memoryBytes()
+// The arrays a traversal walks are HugeVectors (HugePages.cpp), so large
+// graphs can be stored on huge pages
+
+// Adjacency sequences: one container of neighbors per vertex (list, deque or
+// vector), cheap to change
+template <class Container>
+class SequenceAdjacency
+{
+private:
+    HugeVector<Container> lists; // Neighbors of every vertex
+
+public:
+    static const bool skips_visited = false; // See BitMatrixAdjacency
+
+    // Position in the neighbors of a vertex
+    struct Cursor
+    {
+        typename Container::const_iterator at, end;
+    };
+
+    // Drop every vertex and release the memory, keeping room for vertices
+    void clear(int vertices = 0)
+    {
+        HugeVector<Container>().swap(lists);
+        lists.reserve(vertices);
+    }
+
+    void addVertex() { lists.emplace_back(); }
+
+    void add(int u, int w) { lists[u].push_back(w); }
+
+    // Remove every u->w edge; returns the number removed
+    size_t removeAll(int u, int w)
+    {
+        size_t before = lists[u].size();
+        if constexpr (is_same<Container, list<int>>::value)
+        {
+            lists[u].remove(w);
+        }
+        else
+        {
+            lists[u].erase(remove(lists[u].begin(), lists[u].end(), w), lists[u].end());
+        }
+        return before - lists[u].size();
+    }
+
+    size_t count(int u, int w) const
+    {
+        return std::count(lists[u].begin(), lists[u].end(), w);
+    }
+
+    size_t degree(int u) const { return lists[u].size(); }
+
+    template <class F>
+    void forEach(int u, F f) const
+    {
+        for (int w : lists[u])
+        {
+            f(w);
+        }
+    }
+
+    Cursor cursor(int u) const { return {lists[u].cbegin(), lists[u].cend()}; }
+
+    // Next neighbor of a cursor; returns false at the end
+    bool next(Cursor &c, int &w) const
+    {
+        if (c.at == c.end)
+        {
+            return false;
+        }
+        w = *c.at++;
+        return true;
+    }
+
+    // Nothing is deferred in sequences
+    void prepare() {}
+
+    // Rebuild the lists with new indices: order[i] is the old index of vertex i
+    void relabel(const vector<int> &order, const vector<int> &new_of_old)
+    {
+        HugeVector<Container> relabeled(order.size());
+        for (size_t i = 0; i < order.size(); i++)
+        {
+            for (int w : lists[order[i]])
+            {
+                relabeled[i].push_back(new_of_old[w]);
+            }
+        }
+        lists.swap(relabeled);
+    }
+
+    // Approximate heap use: a container header per vertex, plus a node and
+    // the allocator's header per edge for lists, or the element for the
+    // contiguous containers
+    size_t memoryBytes(size_t edges) const
+    {
+        size_t per_edge = sizeof(int);
+        if constexpr (is_same<Container, list<int>>::value)
+        {
+            per_edge += 2 * sizeof(void *) + 8;
+        }
+        return lists.capacity() * sizeof(Container) + edges * per_edge;
+    }
+};
+
+typedef SequenceAdjacency<list<int>> ListAdjacency;
+typedef SequenceAdjacency<deque<int>> DequeAdjacency;
+
+// Compressed adjacency: the neighbors of every vertex are sorted and stored
+// as varint encoded gaps in one byte array, with an 8-byte offset per vertex
+// (a compressed sparse row layout)
+// After a reorder most gaps fit in one byte, so an edge costs 1-2 bytes per
+// direction instead of a list node
+// Changes are logged and merged into the array in one pass before the next
+// traversal, or when the log outgrows the array (so loading a graph edge by
+// edge merges a geometric number of times), and adding an edge stays O(1)
+// amortized
+class CompressedAdjacency
+{
+private:
+    // A logged change
+    struct Change
+    {
+        uint32_t from; // Source vertex
+        uint32_t to;   // Target vertex
+        bool add;      // Add one u->w edge, or remove all of them
+    };
+
+    HugeVector<uint64_t> offsets; // First byte of every vertex; offsets[V] is the end
+    HugeVector<uint8_t> bytes;    // The encoded neighbor lists
+    vector<Change> pending;   // Changes not merged yet, in order
+
+    static void encode(HugeVector<uint8_t> &out, uint32_t value)
+    {
+        while (value >= 0x80)
+        {
+            out.push_back((uint8_t)(value | 0x80));
+            value >>= 7;
+        }
+        out.push_back((uint8_t)value);
+    }
+
+    static uint32_t decode(const uint8_t *&at)
+    {
+        uint32_t value = *at & 0x7f;
+        int shift = 7;
+        while (*at++ & 0x80)
+        {
+            value |= (uint32_t)(*at & 0x7f) << shift;
+            shift += 7;
+        }
+        return value;
+    }
+
+    // Append a sorted list of neighbors as gaps
+    static void encodeList(HugeVector<uint8_t> &out, const vector<uint32_t> &neighbors)
+    {
+        uint32_t prev = 0;
+        for (uint32_t w : neighbors)
+        {
+            encode(out, w - prev);
+            prev = w;
+        }
+    }
+
+    // Decode the merged neighbors of u
+    void decodeList(int u, vector<uint32_t> &neighbors) const
+    {
+        neighbors.clear();
+        const uint8_t *at = bytes.data() + offsets[u];
+        const uint8_t *end = bytes.data() + offsets[u + 1];
+        uint32_t prev = 0;
+        while (at < end)
+        {
+            prev += decode(at);
+            neighbors.push_back(prev);
+        }
+    }
+
+    // Merge the logged changes into the byte array
+    void merge()
+    {
+        stable_sort(pending.begin(), pending.end(), [](const Change &a, const Change &b)
+                    { return a.from < b.from; });
+        size_t vertices = offsets.size() - 1;
+        HugeVector<uint64_t> merged_offsets(vertices + 1);
+        HugeVector<uint8_t> merged;
+        vector<uint32_t> neighbors;
+        merged.reserve(bytes.size() + pending.size() * 2);
+        size_t p = 0;
+        for (size_t u = 0; u < vertices; u++)
+        {
+            merged_offsets[u] = merged.size();
+            if (p == pending.size() || pending[p].from != u)
+            {
+                merged.insert(merged.end(), bytes.begin() + offsets[u], bytes.begin() + offsets[u + 1]);
+                continue;
+            }
+            decodeList(u, neighbors);
+            for (; p < pending.size() && pending[p].from == u; p++)
+            {
+                if (pending[p].add)
+                {
+                    neighbors.push_back(pending[p].to);
+                }
+                else
+                {
+                    neighbors.erase(remove(neighbors.begin(), neighbors.end(), pending[p].to), neighbors.end());
+                }
+            }
+            sort(neighbors.begin(), neighbors.end());
+            encodeList(merged, neighbors);
+        }
+        merged_offsets[vertices] = merged.size();
+        offsets.swap(merged_offsets);
+        bytes.swap(merged);
+        vector<Change>().swap(pending);
+    }
+
+    void log(uint32_t u, uint32_t w, bool add)
+    {
+        pending.push_back({u, w, add});
+        if (pending.size() > 1024 + bytes.size())
+        {
+            merge();
+        }
+    }
+
+public:
+    static const bool skips_visited = false; // See BitMatrixAdjacency
+
+    // Position in the neighbors of a vertex
+    // Gaps that fit in one byte are decoded eight at a time: when none of the
+    // next eight bytes has its continuation bit set (one 64-bit test) they are
+    // eight whole gaps, so the bytes are summed into buf without a branch per
+    // byte
+    struct Cursor
+    {
+        const uint8_t *at;  // Next byte to decode
+        const uint8_t *end; // End of the vertex's bytes
+        uint32_t prev;      // Last neighbor decoded
+        uint8_t count;      // Neighbors waiting in buf
+        uint8_t taken;      // Neighbors of buf already returned
+        uint32_t buf[8];    // Neighbors decoded ahead
+    };
+
+    CompressedAdjacency() : offsets(1, 0) {}
+
+    void clear(int vertices = 0)
+    {
+        HugeVector<uint64_t>(1, 0).swap(offsets);
+        offsets.reserve(vertices + 1);
+        HugeVector<uint8_t>().swap(bytes);
+        vector<Change>().swap(pending);
+    }
+
+    void addVertex() { offsets.push_back(bytes.size()); }
+
+    void add(int u, int w) { log(u, w, true); }
+
+    size_t removeAll(int u, int w)
+    {
+        size_t removed = count(u, w);
+        if (removed > 0)
+        {
+            log(u, w, false);
+        }
+        return removed;
+    }
+
+    size_t count(int u, int w) const
+    {
+        size_t found = 0;
+        const uint8_t *at = bytes.data() + offsets[u];
+        const uint8_t *end = bytes.data() + offsets[u + 1];
+        uint32_t prev = 0;
+        while (at < end && prev <= (uint32_t)w)
+        {
+            prev += decode(at);
+            found += (prev == (uint32_t)w);
+        }
+        for (const Change &change : pending)
+        {
+            if (change.from == (uint32_t)u && change.to == (uint32_t)w)
+            {
+                found = change.add ? found + 1 : 0;
+            }
+        }
+        return found;
+    }
+
+    // Number of merged neighbors: the bytes without a continuation bit
+    size_t degree(int u) const
+    {
+        const uint8_t *at = bytes.data() + offsets[u];
+        const uint8_t *end = bytes.data() + offsets[u + 1];
+        size_t ends = 0;
+        for (; at + 8 <= end; at += 8)
+        {
+            uint64_t word;
+            memcpy(&word, at, 8);
+            ends += 8 - __builtin_popcountll(word & 0x8080808080808080ULL);
+        }
+        for (; at < end; at++)
+        {
+            ends += !(*at & 0x80);
+        }
+        return ends;
+    }
+
+    template <class F>
+    void forEach(int u, F f) const
+    {
+        Cursor c = cursor(u);
+        int w;
+        while (next(c, w))
+        {
+            f(w);
+        }
+    }
+
+    Cursor cursor(int u) const
+    {
+        Cursor c;
+        c.at = bytes.data() + offsets[u];
+        c.end = bytes.data() + offsets[u + 1];
+        c.prev = 0;
+        c.count = 0;
+        c.taken = 0;
+        return c;
+    }
+
+    bool next(Cursor &c, int &w) const
+    {
+        if (c.taken < c.count)
+        {
+            w = c.buf[c.taken++];
+            return true;
+        }
+        if (c.at == c.end)
+        {
+            return false;
+        }
+        uint64_t word;
+        if (c.end - c.at >= 8 && (memcpy(&word, c.at, 8), (word & 0x8080808080808080ULL) == 0))
+        {
+            uint32_t prev = c.prev;
+            for (int i = 0; i < 8; i++)
+            {
+                prev += c.at[i];
+                c.buf[i] = prev;
+            }
+            c.at += 8;
+            c.prev = prev;
+            c.count = 8;
+            c.taken = 1;
+            w = c.buf[0];
+            return true;
+        }
+        c.prev += decode(c.at);
+        c.count = 0;
+        c.taken = 0;
+        w = c.prev;
+        return true;
+    }
+
+    // Merge the logged changes before a traversal
+    void prepare()
+    {
+        if (!pending.empty())
+        {
+            merge();
+        }
+    }
+
+    void relabel(const vector<int> &order, const vector<int> &new_of_old)
+    {
+        prepare();
+        HugeVector<uint64_t> relabeled_offsets(order.size() + 1);
+        HugeVector<uint8_t> relabeled;
+        vector<uint32_t> neighbors;
+        relabeled.reserve(bytes.size());
+        for (size_t i = 0; i < order.size(); i++)
+        {
+            relabeled_offsets[i] = relabeled.size();
+            decodeList(order[i], neighbors);
+            for (uint32_t &w : neighbors)
+            {
+                w = new_of_old[w];
+            }
+            sort(neighbors.begin(), neighbors.end());
+            encodeList(relabeled, neighbors);
+        }
+        relabeled_offsets[order.size()] = relabeled.size();
+        offsets.swap(relabeled_offsets);
+        bytes.swap(relabeled);
+    }
+
+    size_t memoryBytes(size_t) const
+    {
+        return offsets.capacity() * sizeof(uint64_t) + bytes.capacity() + pending.capacity() * sizeof(Change);
+    }
+};
+
+// Plain compressed sparse row storage: the neighbors of every vertex are
+// stored contiguously as Index values (uint16_t for graphs of up to 65536
+// vertices, so a traversal reads half the bytes of 32-bit indices)
+// Built once: the edges added are sorted into rows by prepare()
+template <class Index>
+class CsrAdjacency
+{
+private:
+    HugeVector<uint64_t> offsets;             // First neighbor of every vertex; offsets[V] is the end
+    HugeVector<Index> targets;                // The neighbors, row by row
+    vector<pair<Index, Index>> pending;       // Edges not in the rows yet
+
+public:
+    static const bool skips_visited = false; // See BitMatrixAdjacency
+
+    // Position in the neighbors of a vertex
+    struct Cursor
+    {
+        const Index *at, *end;
+    };
+
+    CsrAdjacency() : offsets(1, 0) {}
+
+    void clear(int vertices = 0)
+    {
+        HugeVector<uint64_t>(1, 0).swap(offsets);
+        offsets.reserve(vertices + 1);
+        HugeVector<Index>().swap(targets);
+        vector<pair<Index, Index>>().swap(pending);
+    }
+
+    void addVertex() { offsets.push_back(targets.size()); }
+
+    void add(int u, int w) { pending.emplace_back((Index)u, (Index)w); }
+
+    size_t degree(int u) const { return offsets[u + 1] - offsets[u]; }
+
+    template <class F>
+    void forEach(int u, F f) const
+    {
+        for (uint64_t i = offsets[u]; i < offsets[u + 1]; i++)
+        {
+            f((int)targets[i]);
+        }
+    }
+
+    Cursor cursor(int u) const { return {targets.data() + offsets[u], targets.data() + offsets[u + 1]}; }
+
+    bool next(Cursor &c, int &w) const
+    {
+        if (c.at == c.end)
+        {
+            return false;
+        }
+        w = *c.at++;
+        return true;
+    }
+
+    // Sort the pending edges into the rows (a counting sort by source)
+    void prepare()
+    {
+        if (pending.empty())
+        {
+            return;
+        }
+        size_t vertices = offsets.size() - 1;
+        HugeVector<uint64_t> merged_offsets(vertices + 1, 0);
+        for (size_t u = 0; u < vertices; u++)
+        {
+            merged_offsets[u + 1] = offsets[u + 1] - offsets[u];
+        }
+        for (const auto &edge : pending)
+        {
+            merged_offsets[edge.first + 1]++;
+        }
+        for (size_t u = 0; u < vertices; u++)
+        {
+            merged_offsets[u + 1] += merged_offsets[u];
+        }
+        HugeVector<Index> merged(merged_offsets[vertices]);
+        vector<uint64_t> fill_at(merged_offsets.begin(), merged_offsets.end() - 1);
+        for (size_t u = 0; u < vertices; u++)
+        {
+            for (uint64_t i = offsets[u]; i < offsets[u + 1]; i++)
+            {
+                merged[fill_at[u]++] = targets[i];
+            }
+        }
+        for (const auto &edge : pending)
+        {
+            merged[fill_at[edge.first]++] = edge.second;
+        }
+        offsets.swap(merged_offsets);
+        targets.swap(merged);
+        vector<pair<Index, Index>>().swap(pending);
+    }
+
+    size_t memoryBytes(size_t) const
+    {
+        return offsets.capacity() * sizeof(uint64_t) + targets.capacity() * sizeof(Index) +
+               pending.capacity() * sizeof(pair<Index, Index>);
+    }
+};
+
+// Adjacency matrix with one bit per vertex pair, for small dense graphs
+// Rows are arrays of 64-bit words, so a traversal can skip 64 non-neighbors
+// at once, and nextUnvisited() masks a row with the visited set of the SCC
+// kernel (skips_visited) to find the next unvisited neighbor without looking
+// at the visited ones
+// A row holds stride words; adding a vertex past it doubles the stride
+class BitMatrixAdjacency
+{
+private:
+    HugeVector<uint64_t> bits; // Row u is bits[u * stride .. (u + 1) * stride)
+    size_t vertices = 0;   // Number of rows
+    size_t stride = 0;     // Words per row
+
+    // Words of a row that can hold a bit (the rest are zero)
+    size_t usedWords() const { return (vertices + 63) / 64; }
+
+public:
+    static const bool skips_visited = true;
+
+    // Position in the row of a vertex
+    struct Cursor
+    {
+        const uint64_t *row; // The row
+        size_t word;         // Word of the row being scanned
+        uint64_t rest;       // Bits of that word not returned yet
+    };
+
+    void clear(int reserve_vertices = 0)
+    {
+        vertices = 0;
+        stride = (reserve_vertices + 63) / 64;
+        HugeVector<uint64_t>().swap(bits);
+        bits.reserve((size_t)reserve_vertices * stride);
+    }
+
+    void addVertex()
+    {
+        if (vertices + 1 > stride * 64)
+        {
+            size_t wider = max<size_t>(1, stride * 2);
+            HugeVector<uint64_t> grown(vertices * wider, 0);
+            for (size_t u = 0; u < vertices; u++)
+            {
+                copy(bits.begin() + u * stride, bits.begin() + (u + 1) * stride, grown.begin() + u * wider);
+            }
+            bits.swap(grown);
+            stride = wider;
+        }
+        vertices++;
+        bits.resize(vertices * stride, 0);
+    }
+
+    void add(int u, int w) { bits[u * stride + w / 64] |= 1ULL << (w % 64); }
+
+    size_t degree(int u) const
+    {
+        size_t ones = 0;
+        for (size_t i = 0; i < stride; i++)
+        {
+            ones += __builtin_popcountll(bits[u * stride + i]);
+        }
+        return ones;
+    }
+
+    template <class F>
+    void forEach(int u, F f) const
+    {
+        Cursor c = cursor(u);
+        int w;
+        while (next(c, w))
+        {
+            f(w);
+        }
+    }
+
+    Cursor cursor(int u) const
+    {
+        const uint64_t *row = bits.data() + u * stride;
+        return {row, 0, vertices > 0 ? row[0] : 0};
+    }
+
+    bool next(Cursor &c, int &w) const
+    {
+        while (c.rest == 0)
+        {
+            if (++c.word >= usedWords())
+            {
+                return false;
+            }
+            c.rest = c.row[c.word];
+        }
+        w = (int)(c.word * 64 + __builtin_ctzll(c.rest));
+        c.rest &= c.rest - 1;
+        return true;
+    }
+
+    // Next neighbor whose bit is clear in visited (one bit per vertex, rounded
+    // up to whole words)
+    bool nextUnvisited(Cursor &c, const uint64_t *visited, int &w) const
+    {
+        if (vertices == 0)
+        {
+            return false;
+        }
+        c.rest &= ~visited[c.word];
+        while (c.rest == 0)
+        {
+            if (++c.word >= usedWords())
+            {
+                return false;
+            }
+            c.rest = c.row[c.word] & ~visited[c.word];
+        }
+        w = (int)(c.word * 64 + __builtin_ctzll(c.rest));
+        c.rest &= c.rest - 1;
+        return true;
+    }
+
+    void prepare() {}
+
+    size_t memoryBytes(size_t) const { return bits.capacity() * sizeof(uint64_t); }
+};
+
+#endif
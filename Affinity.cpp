@@ -0,0 +1,153 @@
+#ifndef AFFINITY_H
+#define AFFINITY_H
+
+#include <vector>
+#include <string>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+// Placement of threads on CPUs and of memory on NUMA nodes, with the plain
+// system calls (no libnuma)
+// A thread inherits the CPUs and the memory policy of the thread that created
+// it, so setting them on a thread before it starts the others places them all
+
+#define NUMA_MPOL_PREFERRED 1 // MPOL_PREFERRED of <linux/mempolicy.h>
+#define NUMA_MAX_NODES 1024   // Nodes a memory policy mask can name
+
+// Parse a CPU list such as "0-3,8,10-11"
+// Returns the CPUs in the order given, or an empty list if it is not valid
+std::vector<int> parse_cpu_list(const char *list)
+{
+    std::vector<int> cpus;
+    const char *p = list;
+    while (*p != '\0')
+    {
+        char *end;
+        long first = strtol(p, &end, 10);
+        if (end == p || first < 0 || first >= CPU_SETSIZE)
+        {
+            return {};
+        }
+        long last = first;
+        p = end;
+        if (*p == '-')
+        {
+            last = strtol(p + 1, &end, 10);
+            if (end == p + 1 || last < first || last >= CPU_SETSIZE)
+            {
+                return {};
+            }
+            p = end;
+        }
+        for (long cpu = first; cpu <= last; cpu++)
+        {
+            cpus.push_back((int)cpu);
+        }
+        if (*p == ',')
+        {
+            p++;
+        }
+        else if (*p != '\0' && *p != '\n')
+        {
+            return {};
+        }
+        else
+        {
+            break;
+        }
+    }
+    return cpus;
+}
+
+// Parse a NUMA node number; returns false if it is not one
+bool parse_numa_node(const char *text, int &node)
+{
+    char *end;
+    errno = 0;
+    long value = strtol(text, &end, 10);
+    if (end == text || *end != '\0' || errno != 0 || value < 0 || value >= NUMA_MAX_NODES)
+    {
+        return false;
+    }
+    node = (int)value;
+    return true;
+}
+
+// The CPUs of a NUMA node, empty if there is no such node
+std::vector<int> numa_node_cpus(int node)
+{
+    std::string path = "/sys/devices/system/node/node" + std::to_string(node) + "/cpulist";
+    FILE *file = fopen(path.c_str(), "r");
+    if (file == NULL)
+    {
+        return {};
+    }
+    char line[4096] = "";
+    if (fgets(line, sizeof line, file) == NULL)
+    {
+        line[0] = '\0';
+    }
+    fclose(file);
+    return parse_cpu_list(line);
+}
+
+// Let a thread run only on some CPUs
+// Returns false (and says why) if the kernel refused
+bool pin_thread(pthread_t thread, const std::vector<int> &cpus)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus)
+    {
+        CPU_SET(cpu, &set);
+    }
+    int err = pthread_setaffinity_np(thread, sizeof set, &set);
+    if (err != 0)
+    {
+        fprintf(stderr, "pthread_setaffinity_np: %s\n", strerror(err));
+        return false;
+    }
+    return true;
+}
+
+// Allocate the pages the calling thread touches first from a NUMA node,
+// falling back to the others when it is full
+// Returns false (and says why) if the kernel refused
+bool prefer_numa_node(int node)
+{
+    if (node < 0 || node >= NUMA_MAX_NODES)
+    {
+        fprintf(stderr, "no NUMA node %d\n", node);
+        return false;
+    }
+    unsigned long mask[NUMA_MAX_NODES / (8 * sizeof(unsigned long))] = {0};
+    mask[node / (8 * sizeof(unsigned long))] = 1UL << (node % (8 * sizeof(unsigned long)));
+    if (syscall(SYS_set_mempolicy, NUMA_MPOL_PREFERRED, mask, NUMA_MAX_NODES + 1) == -1)
+    {
+        perror("set_mempolicy");
+        return false;
+    }
+    return true;
+}
+
+// Run the calling thread, and the threads it starts from now on, on the CPUs
+// of a NUMA node, with their memory from that node
+// Returns false if the node does not exist or the kernel refused
+bool place_on_numa_node(int node)
+{
+    std::vector<int> cpus = numa_node_cpus(node);
+    if (cpus.empty())
+    {
+        fprintf(stderr, "no NUMA node %d\n", node);
+        return false;
+    }
+    return pin_thread(pthread_self(), cpus) && prefer_numa_node(node);
+}
+
+#endif
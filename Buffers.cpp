@@ -0,0 +1,487 @@
+#ifndef BUFFERS_H
+#define BUFFERS_H
+
+#include <iostream>
+#include <vector>
+#include <deque>
+#include <string>
+#include <algorithm>
+#include <atomic>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <linux/errqueue.h>
+
+#define IO_BUFFER_SIZE (64 * 1024)        // Size of every pooled buffer
+#define IO_POOL_MAX_FREE 256              // Free buffers kept for reuse (16 MB)
+#define IO_READV_BUFFERS 4                // Buffers filled by a single readv()
+#define IO_WRITEV_SEGMENTS 64             // Segments written by a single sendmsg()
+#define IO_ZEROCOPY_MIN (32 * 1024)       // Bytes a sendmsg() must carry to go out with MSG_ZEROCOPY
+#define ENGINE_PIPE_SIZE (1024 * 1024)    // Capacity requested for the engine pipes
+
+// A fixed size slab used for socket and pipe I/O
+// A buffer is shared by reference between the reader that filled it and the
+// output queues of every client it is sent to; the last unref() returns it to the pool
+struct IOBuffer
+{
+    std::atomic<int> refs{1};  // Number of holders
+    size_t len = 0;            // Number of bytes used
+    char data[IO_BUFFER_SIZE]; // The bytes
+};
+
+// Process wide pool of I/O buffers
+// Buffers released by one connection are handed to the next one instead of
+// going back to the allocator
+class BufferPool
+{
+private:
+    pthread_mutex_t lock;             // Protects free_list
+    std::vector<IOBuffer *> free_list; // Buffers ready for reuse
+
+    BufferPool() { pthread_mutex_init(&lock, NULL); }
+
+public:
+    // Get the pool shared by the whole process
+    static BufferPool &instance()
+    {
+        static BufferPool pool;
+        return pool;
+    }
+
+    // Take an empty buffer from the pool
+    IOBuffer *acquire()
+    {
+        IOBuffer *buf = nullptr;
+        pthread_mutex_lock(&lock);
+        if (!free_list.empty())
+        {
+            buf = free_list.back();
+            free_list.pop_back();
+        }
+        pthread_mutex_unlock(&lock);
+        if (buf == nullptr)
+        {
+            buf = new IOBuffer;
+        }
+        buf->refs.store(1, std::memory_order_relaxed);
+        buf->len = 0;
+        return buf;
+    }
+
+    // Add a holder to a buffer
+    static void ref(IOBuffer *buf)
+    {
+        buf->refs.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // Drop a holder of a buffer, releasing it with the last one
+    void unref(IOBuffer *buf)
+    {
+        if (buf->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            release(buf);
+        }
+    }
+
+private:
+    // Give a buffer back to the pool
+    void release(IOBuffer *buf)
+    {
+        pthread_mutex_lock(&lock);
+        if (free_list.size() < IO_POOL_MAX_FREE)
+        {
+            free_list.push_back(buf);
+            buf = nullptr;
+        }
+        pthread_mutex_unlock(&lock);
+        delete buf;
+    }
+};
+
+// Reads into several pooled buffers with a single readv()
+// Buffers still referenced by output queues are swapped for fresh ones before
+// the next read, so the data handed out is never overwritten
+class PooledReader
+{
+private:
+    IOBuffer *bufs[IO_READV_BUFFERS]; // The buffers filled by read_from()
+    struct iovec iov[IO_READV_BUFFERS]; // The filled part of every buffer
+
+public:
+    PooledReader()
+    {
+        for (int i = 0; i < IO_READV_BUFFERS; i++)
+        {
+            bufs[i] = BufferPool::instance().acquire();
+        }
+    }
+
+    ~PooledReader()
+    {
+        for (int i = 0; i < IO_READV_BUFFERS; i++)
+        {
+            BufferPool::instance().unref(bufs[i]);
+        }
+    }
+
+    PooledReader(const PooledReader &) = delete;
+    void operator=(const PooledReader &) = delete;
+
+    // Get the buffers ready for the next read
+    // Returns the IO_READV_BUFFERS iovecs to read into, for a read that is not
+    // made by read_from() (such as one submitted to an io_uring)
+    struct iovec *prepare()
+    {
+        for (int i = 0; i < IO_READV_BUFFERS; i++)
+        {
+            if (bufs[i]->refs.load(std::memory_order_acquire) != 1)
+            {
+                BufferPool::instance().unref(bufs[i]);
+                bufs[i] = BufferPool::instance().acquire();
+            }
+            iov[i].iov_base = bufs[i]->data;
+            iov[i].iov_len = IO_BUFFER_SIZE;
+        }
+        return iov;
+    }
+
+    // Record the result of the read into the iovecs of prepare()
+    void filled(ssize_t nbytes)
+    {
+        size_t left = nbytes > 0 ? nbytes : 0;
+        for (int i = 0; i < IO_READV_BUFFERS; i++)
+        {
+            bufs[i]->len = left < IO_BUFFER_SIZE ? left : IO_BUFFER_SIZE;
+            iov[i].iov_len = bufs[i]->len;
+            left -= bufs[i]->len;
+        }
+    }
+
+    // Read from fd; returns the result of readv()
+    ssize_t read_from(int fd)
+    {
+        ssize_t nbytes = readv(fd, prepare(), IO_READV_BUFFERS);
+        filled(nbytes);
+        return nbytes;
+    }
+
+    // The buffers filled by the last read_from()
+    IOBuffer *const *buffers() const { return bufs; }
+
+    // Number of buffers holding data
+    int buffer_count() const
+    {
+        int count = 0;
+        while (count < IO_READV_BUFFERS && bufs[count]->len > 0)
+        {
+            count++;
+        }
+        return count;
+    }
+};
+
+// Bytes waiting to be written to a socket, written with one sendmsg() of
+// many slices so a whole batch of responses leaves in one system call
+// Data from the engine is queued by reference to the buffer it was read into
+// (no copy, whatever the number of clients it goes to); only small strings
+// such as end markers are copied into buffers owned by the queue
+// With zerocopy enabled, a sendmsg() of at least IO_ZEROCOPY_MIN bytes also
+// skips the copy into the kernel (MSG_ZEROCOPY): the kernel sends from the
+// buffers themselves, so they stay referenced ("pinned") until it reports on
+// the socket's error queue that it is done with them
+class OutputQueue
+{
+private:
+    // A slice of a buffer
+    struct Segment
+    {
+        IOBuffer *buf; // The buffer (one reference held by the queue)
+        size_t off;    // First byte of the slice
+        size_t len;    // Length of the slice
+    };
+
+    // A buffer the kernel may still send from
+    struct Pinned
+    {
+        uint32_t send; // Number of the zerocopy sendmsg() that used it
+        IOBuffer *buf; // The buffer (one reference held until that send completes)
+    };
+
+    std::deque<Segment> segs;    // Queued slices in order
+    size_t queued = 0;           // Total bytes waiting
+    IOBuffer *tail = nullptr;    // Buffer owned by the queue for copied bytes
+    bool zerocopy = false;       // True if large sends go out with MSG_ZEROCOPY
+    uint32_t zerocopy_sends = 0; // Zerocopy sendmsg() calls made, numbered from 0 like the kernel does
+    std::deque<Pinned> pinned;   // Buffers of the zerocopy sends not completed yet, oldest first
+
+public:
+    OutputQueue() = default;
+    OutputQueue(const OutputQueue &) = delete;
+    void operator=(const OutputQueue &) = delete;
+
+    ~OutputQueue()
+    {
+        clear();
+        for (const Pinned &p : pinned)
+        {
+            BufferPool::instance().unref(p.buf);
+        }
+    }
+
+    // Number of bytes waiting
+    size_t size() const { return queued; }
+
+    // Number of sendmsg() calls made with MSG_ZEROCOPY
+    uint32_t zerocopy_count() const { return zerocopy_sends; }
+
+    // Send the large batches to a TCP socket with MSG_ZEROCOPY
+    // Returns false if the socket does not support it
+    bool enable_zerocopy(int fd)
+    {
+        int one = 1;
+        zerocopy = setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof one) == 0;
+        return zerocopy;
+    }
+
+    // Release the buffers of the zerocopy sends the kernel completed
+    // The completions wait on the socket's error queue, which makes it report
+    // POLLERR until they are read, so a poller calls this when the socket
+    // woke it with nothing to read
+    void reap(int fd)
+    {
+        while (!pinned.empty())
+        {
+            char control[128];
+            struct msghdr msg;
+            memset(&msg, 0, sizeof msg);
+            msg.msg_control = control;
+            msg.msg_controllen = sizeof control;
+            if (recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) == -1)
+            {
+                return; // Nothing completed since the last call
+            }
+            for (struct cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm != NULL; cm = CMSG_NXTHDR(&msg, cm))
+            {
+                if ((cm->cmsg_level != SOL_IP || cm->cmsg_type != IP_RECVERR) &&
+                    (cm->cmsg_level != SOL_IPV6 || cm->cmsg_type != IPV6_RECVERR))
+                {
+                    continue;
+                }
+                const struct sock_extended_err *err = (const struct sock_extended_err *)CMSG_DATA(cm);
+                if (err->ee_errno != 0 || err->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+                {
+                    continue;
+                }
+                if (err->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+                {
+                    // The kernel copied the data anyway (as over loopback):
+                    // pinning the buffers only costs, so stop asking
+                    zerocopy = false;
+                }
+                unpin(err->ee_info, err->ee_data);
+            }
+        }
+    }
+
+    // Get the socket ready to be closed, with the queue's lock held
+    // Zerocopy sends still in flight would go on reading buffers that are
+    // released along with the queue, so the socket is then reset on close
+    // (SO_LINGER of 0), which drops them
+    void abandon(int fd)
+    {
+        reap(fd);
+        if (!pinned.empty())
+        {
+            struct linger reset = {1, 0};
+            setsockopt(fd, SOL_SOCKET, SO_LINGER, &reset, sizeof reset);
+        }
+    }
+
+    // Copy bytes to the end of the queue
+    void append(const char *data, size_t len)
+    {
+        while (len > 0)
+        {
+            if (tail == nullptr || tail->len == IO_BUFFER_SIZE)
+            {
+                if (tail != nullptr)
+                {
+                    BufferPool::instance().unref(tail);
+                }
+                tail = BufferPool::instance().acquire(); // Reference held by the queue itself
+            }
+            size_t n = std::min(len, IO_BUFFER_SIZE - tail->len);
+            memcpy(tail->data + tail->len, data, n);
+            if (!segs.empty() && segs.back().buf == tail && segs.back().off + segs.back().len == tail->len)
+            {
+                segs.back().len += n;
+            }
+            else
+            {
+                BufferPool::ref(tail);
+                segs.push_back({tail, tail->len, n});
+            }
+            tail->len += n;
+            queued += n;
+            data += n;
+            len -= n;
+        }
+    }
+
+    void append(const std::string &data) { append(data.data(), data.size()); }
+
+    // Queue a slice of a shared buffer without copying it
+    void append_shared(IOBuffer *buf, size_t off, size_t len)
+    {
+        if (len == 0)
+        {
+            return;
+        }
+        queued += len;
+        if (!segs.empty() && segs.back().buf == buf && segs.back().off + segs.back().len == off)
+        {
+            segs.back().len += len;
+            return;
+        }
+        BufferPool::ref(buf);
+        segs.push_back({buf, off, len});
+    }
+
+    // Write the queue to a socket, IO_WRITEV_SEGMENTS slices per sendmsg()
+    // Never blocks: stops early once the socket is full, and the rest waits
+    // for the socket to become writable
+    // Returns false if the socket failed (the queue is then dropped)
+    bool flush(int fd)
+    {
+        reap(fd);
+        while (queued > 0)
+        {
+            struct iovec iov[IO_WRITEV_SEGMENTS];
+            int count = 0;
+            size_t bytes = 0;
+            for (auto it = segs.begin(); it != segs.end() && count < IO_WRITEV_SEGMENTS; ++it, ++count)
+            {
+                iov[count].iov_base = it->buf->data + it->off;
+                iov[count].iov_len = it->len;
+                bytes += it->len;
+            }
+            struct msghdr msg;
+            memset(&msg, 0, sizeof msg);
+            msg.msg_iov = iov;
+            msg.msg_iovlen = count;
+            bool pin = zerocopy && bytes >= IO_ZEROCOPY_MIN;
+            ssize_t n = sendmsg(fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL | (pin ? MSG_ZEROCOPY : 0));
+            if (n == -1 && pin && errno == ENOBUFS)
+            {
+                // Out of memory to pin the pages with: copy this batch
+                pin = false;
+                n = sendmsg(fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+            }
+            if (n == -1)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                {
+                    return true;
+                }
+                perror("sendmsg");
+                clear();
+                return false;
+            }
+            if (pin)
+            {
+                pin_sent(n);
+            }
+            consume(n);
+        }
+        return true;
+    }
+
+    // Drop everything that is queued
+    void clear()
+    {
+        consume(queued);
+    }
+
+private:
+    // Keep the buffers of the first n bytes, just sent with MSG_ZEROCOPY,
+    // until the kernel is done with them
+    void pin_sent(size_t n)
+    {
+        for (auto it = segs.begin(); n > 0; ++it)
+        {
+            if (pinned.empty() || pinned.back().send != zerocopy_sends || pinned.back().buf != it->buf)
+            {
+                BufferPool::ref(it->buf);
+                pinned.push_back({zerocopy_sends, it->buf});
+            }
+            n -= std::min(n, it->len);
+        }
+        zerocopy_sends++;
+    }
+
+    // Release the buffers of the zerocopy sends first to last (a range that
+    // may wrap around)
+    void unpin(uint32_t first, uint32_t last)
+    {
+        for (auto it = pinned.begin(); it != pinned.end();)
+        {
+            if (it->send - first <= last - first)
+            {
+                BufferPool::instance().unref(it->buf);
+                it = pinned.erase(it);
+            }
+            else
+            {
+                ++it;
+            }
+        }
+    }
+
+    // Remove n written bytes from the front of the queue
+    void consume(size_t n)
+    {
+        queued -= n;
+        while (n > 0)
+        {
+            Segment &head = segs.front();
+            if (n < head.len)
+            {
+                head.off += n;
+                head.len -= n;
+                return;
+            }
+            n -= head.len;
+            BufferPool::instance().unref(head.buf);
+            segs.pop_front();
+        }
+        if (queued == 0 && tail != nullptr)
+        {
+            // Nothing left to write: let an idle connection hold no buffer
+            BufferPool::instance().unref(tail);
+            tail = nullptr;
+        }
+    }
+};
+
+// Grow a pipe so large responses cross it with few read()/write() calls
+void enlarge_pipe(int fd)
+{
+#ifdef F_SETPIPE_SZ
+    if (fcntl(fd, F_SETPIPE_SZ, ENGINE_PIPE_SIZE) == -1)
+    {
+        perror("fcntl(F_SETPIPE_SZ)");
+    }
+#endif
+}
+
+#endif
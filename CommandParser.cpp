@@ -0,0 +1,217 @@
+#ifndef COMMAND_PARSER_H
+#define COMMAND_PARSER_H
+
+#include <string>
+#include <string_view>
+#include <charconv>
+#include <stdint.h>
+#include <string.h>
+
+// Parsing of the engine's command lines straight from the bytes they arrived
+// in: no line, word or parameter is copied into a string, the verb is found
+// by its first byte and its length, and the numbers are read with
+// std::from_chars, so the commands that carry edges allocate nothing
+// The lines of a batch are split with memchr(), which glibc scans with
+// vector instructions
+
+// Verbs of the engine's commands
+enum CommandVerb
+{
+    VERB_NONE,       // Empty line
+    VERB_NEWGRAPH,
+    VERB_NEWEDGE,
+    VERB_REMOVEEDGE,
+    VERB_K,
+    VERB_JOBS,
+    VERB_CANCEL,
+    VERB_STATS,
+    VERB_REORDER,
+    VERB_STORAGE,
+    VERB_TOPO,
+    VERB_HASCYCLE,
+    VERB_BFS,
+    VERB_REACH,
+    VERB_END,
+    VERB_UNKNOWN     // Anything else, such as the edge lines of a Newgraph
+};
+
+// A command line split into its verb and its parameters
+struct Command
+{
+    CommandVerb verb = VERB_NONE;
+    std::string_view params; // Everything after the verb, spaces included
+};
+
+// Find the verb of a command line
+inline Command parse_command(std::string_view line)
+{
+    Command command;
+    size_t start = line.find_first_not_of(' ');
+    if (start == std::string_view::npos)
+    {
+        return command;
+    }
+    size_t end = line.find(' ', start);
+    end = end == std::string_view::npos ? line.size() : end;
+    std::string_view word = line.substr(start, end - start);
+    command.params = line.substr(end);
+    command.verb = VERB_UNKNOWN;
+    switch (word[0])
+    {
+    case 'N':
+        if (word == "Newedge")
+            command.verb = VERB_NEWEDGE;
+        else if (word == "Newgraph")
+            command.verb = VERB_NEWGRAPH;
+        break;
+    case 'R':
+        if (word == "Removeedge")
+            command.verb = VERB_REMOVEEDGE;
+        else if (word == "Reorder")
+            command.verb = VERB_REORDER;
+        else if (word == "Reach")
+            command.verb = VERB_REACH;
+        break;
+    case 'T':
+        if (word == "Topo")
+            command.verb = VERB_TOPO;
+        break;
+    case 'H':
+        if (word == "HasCycle")
+            command.verb = VERB_HASCYCLE;
+        break;
+    case 'B':
+        if (word == "BFS")
+            command.verb = VERB_BFS;
+        break;
+    case 'K':
+        if (word.size() == 1)
+            command.verb = VERB_K;
+        break;
+    case 'J':
+        if (word == "Jobs")
+            command.verb = VERB_JOBS;
+        break;
+    case 'C':
+        if (word == "Cancel")
+            command.verb = VERB_CANCEL;
+        break;
+    case 'S':
+        if (word == "Stats")
+            command.verb = VERB_STATS;
+        else if (word == "Storage")
+            command.verb = VERB_STORAGE;
+        break;
+    case 'e':
+        if (word == "end")
+            command.verb = VERB_END;
+        break;
+    }
+    return command;
+}
+
+// Read an unsigned number after optional spaces, moving p past it
+inline bool scan_uint(const char *&p, const char *end, uint64_t &value)
+{
+    while (p < end && *p == ' ')
+    {
+        p++;
+    }
+    std::from_chars_result r = std::from_chars(p, end, value);
+    if (r.ec != std::errc() || r.ptr == p)
+    {
+        return false;
+    }
+    p = r.ptr;
+    return true;
+}
+
+// Parse exactly one unsigned number, with optional spaces around it
+inline bool scan_number(std::string_view text, uint64_t &value)
+{
+    const char *p = text.data();
+    const char *end = p + text.size();
+    if (!scan_uint(p, end, value))
+    {
+        return false;
+    }
+    while (p < end && *p == ' ')
+    {
+        p++;
+    }
+    return p == end;
+}
+
+// Parse two unsigned numbers separated by a comma or by spaces ("1,2",
+// "1, 2" or "1 2"), with optional spaces around them
+inline bool scan_pair(std::string_view text, uint64_t &a, uint64_t &b)
+{
+    const char *p = text.data();
+    const char *end = p + text.size();
+    if (!scan_uint(p, end, a))
+    {
+        return false;
+    }
+    const char *after_a = p;
+    while (p < end && *p == ' ')
+    {
+        p++;
+    }
+    if (p < end && *p == ',')
+    {
+        p++;
+    }
+    else if (p == after_a)
+    {
+        return false; // Neither a comma nor a space between the numbers
+    }
+    if (!scan_uint(p, end, b))
+    {
+        return false;
+    }
+    while (p < end && *p == ' ')
+    {
+        p++;
+    }
+    return p == end;
+}
+
+// The parameters of a command with their spaces removed, for the commands
+// whose parameters are words (Reorder, Storage, K)
+inline std::string without_spaces(std::string_view text)
+{
+    std::string compact;
+    compact.reserve(text.size());
+    for (char c : text)
+    {
+        if (c != ' ')
+        {
+            compact += c;
+        }
+    }
+    return compact;
+}
+
+// Call on_line(std::string_view) for every complete line of a buffer, without
+// its newline (and the '\r' telnet sends before it)
+// Returns the number of bytes used: everything up to the last newline
+template <typename Func>
+size_t for_each_line(const char *buf, size_t len, Func on_line)
+{
+    const char *p = buf;
+    const char *end = buf + len;
+    const char *newline;
+    while ((newline = static_cast<const char *>(memchr(p, '\n', end - p))) != nullptr)
+    {
+        const char *line_end = newline;
+        if (line_end > p && line_end[-1] == '\r')
+        {
+            line_end--;
+        }
+        on_line(std::string_view(p, line_end - p));
+        p = newline + 1;
+    }
+    return p - buf;
+}
+
+#endif
@@ -0,0 +1,126 @@
+#ifndef CONNECTIONS_H
+#define CONNECTIONS_H
+
+#include <vector>
+#include <pthread.h>
+#include <stdint.h>
+#include "libraries.cpp"
+#include "Metrics.cpp"
+
+// The server core's table of client connections, indexed by socket
+// The connection objects are recycled through a free list, so their number
+// is the peak of simultaneous connections, not the number of connections
+// ever accepted, and the memory of a server stays flat under any number of
+// short connections. Every connection has an idle timer on a TimingWheel
+
+// State of a client connection
+struct Connection : TimerNode
+{
+    int fd = -1; // Client socket
+};
+
+class ConnectionTable
+{
+private:
+    pthread_mutex_t lock;                  // Protects everything below
+    std::vector<Connection *> by_fd;       // Connection of every socket, null if none
+    std::vector<Connection *> free_list;   // Connection objects ready for reuse
+    TimingWheel wheel;                     // Idle timers, in ms
+    uint64_t idle_ms = 0;                  // Idle timeout, 0 for none
+
+    static uint64_t now_ms() { return now_ns() / 1000000; }
+
+public:
+    ConnectionTable() : wheel(now_ms()) { pthread_mutex_init(&lock, NULL); }
+
+    // Set the time after which a connection without input is closed (0: never)
+    void set_idle_timeout(uint64_t ms)
+    {
+        idle_ms = ms;
+    }
+
+    // The idle timeout in ms, 0 for none
+    uint64_t idle_timeout() const { return idle_ms; }
+
+    // Register a new client socket
+    void add(int fd)
+    {
+        pthread_mutex_lock(&lock);
+        Connection *conn;
+        if (free_list.empty())
+        {
+            conn = new Connection;
+            server_metrics().connection_objects.add(1);
+        }
+        else
+        {
+            conn = free_list.back();
+            free_list.pop_back();
+        }
+        conn->fd = fd;
+        if ((size_t)fd >= by_fd.size())
+        {
+            by_fd.resize(fd + 1, nullptr);
+        }
+        by_fd[fd] = conn;
+        if (idle_ms > 0)
+        {
+            wheel.schedule(conn, now_ms() + idle_ms);
+        }
+        pthread_mutex_unlock(&lock);
+    }
+
+    // Note input from a client, which restarts its idle timer
+    void touch(int fd)
+    {
+        if (idle_ms == 0)
+        {
+            return;
+        }
+        pthread_mutex_lock(&lock);
+        if ((size_t)fd < by_fd.size() && by_fd[fd] != nullptr)
+        {
+            wheel.schedule(by_fd[fd], now_ms() + idle_ms);
+        }
+        pthread_mutex_unlock(&lock);
+    }
+
+    // Forget a client socket; must be called before it is closed, so that
+    // expire() never acts on a number another connection got in the meantime
+    void remove(int fd)
+    {
+        pthread_mutex_lock(&lock);
+        if ((size_t)fd < by_fd.size() && by_fd[fd] != nullptr)
+        {
+            Connection *conn = by_fd[fd];
+            wheel.cancel(conn);
+            conn->fd = -1;
+            free_list.push_back(conn);
+            by_fd[fd] = nullptr;
+        }
+        pthread_mutex_unlock(&lock);
+    }
+
+    // Call on_idle(fd) for every connection whose idle timer expired
+    // on_idle returns false to keep the connection, whose timer then restarts
+    // Returns the time in ms until the next call may have work to do
+    template <typename Func>
+    uint64_t expire(Func on_idle)
+    {
+        pthread_mutex_lock(&lock);
+        uint64_t now = now_ms();
+        wheel.advance(now, [&](TimerNode *node)
+                      {
+                          Connection *conn = static_cast<Connection *>(node);
+                          if (!on_idle(conn->fd))
+                          {
+                              wheel.schedule(conn, now + idle_ms);
+                          }
+                      });
+        uint64_t next = wheel.nextWakeup();
+        pthread_mutex_unlock(&lock);
+        return next == UINT64_MAX ? UINT64_MAX : next - now;
+    }
+};
+
+#endif
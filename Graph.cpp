@@ -3,54 +3,436 @@
 
 #include <iostream>
 #include <vector>
-#include <stack>
+#include <string>
+#include <sstream>
 #include <list>
 #include <limits>
 #include <algorithm>
+#include <map>
+#include <queue>
+#include <functional>
+#include <errno.h>
+#include <stdlib.h>
 #include <sys/mman.h>
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <stdint.h>
+#include "VertexDictionary.cpp"
+#include "Adjacency.cpp"
+#include "SccKernel.cpp"
+#include "Traversal.cpp"
 using namespace std;
 
+typedef uint64_t VertexId; // Vertex number as the clients see it
+
+// Ways to relabel the vertices for traversal locality
+enum ReorderMode
+{
+    REORDER_NONE,   // Keep the numbering of the clients
+    REORDER_BFS,    // Reverse Cuthill-McKee: neighbors get nearby indices
+    REORDER_DEGREE  // Highest degree first
+};
+
+// Names of the reorder modes, as used by the Reorder command
+const char *reorder_mode_name(ReorderMode mode)
+{
+    static const char *names[] = {"none", "bfs", "degree"};
+    return names[mode];
+}
+
+// Parse the name of a reorder mode; returns false for an unknown name
+bool parse_reorder_mode(const string &name, ReorderMode &mode)
+{
+    for (int m = REORDER_NONE; m <= REORDER_DEGREE; m++)
+    {
+        if (name == reorder_mode_name(static_cast<ReorderMode>(m)))
+        {
+            mode = static_cast<ReorderMode>(m);
+            return true;
+        }
+    }
+    return false;
+}
+
+// Ways to store the edges
+enum StorageMode
+{
+    STORAGE_LIST,   // Linked adjacency lists, cheapest to change
+    STORAGE_COMPACT // Sorted, varint encoded gaps (see Adjacency.cpp)
+};
+
+// Names of the storage modes, as used by the Storage command
+const char *storage_mode_name(StorageMode mode)
+{
+    static const char *names[] = {"list", "compact"};
+    return names[mode];
+}
+
+// Parse the name of a storage mode; returns false for an unknown name
+bool parse_storage_mode(const string &name, StorageMode &mode)
+{
+    for (int m = STORAGE_LIST; m <= STORAGE_COMPACT; m++)
+    {
+        if (name == storage_mode_name(static_cast<StorageMode>(m)))
+        {
+            mode = static_cast<StorageMode>(m);
+            return true;
+        }
+    }
+    return false;
+}
+
+// Parse a vertex number: any unsigned 64-bit integer
+bool parse_vertex_id(const string &text, VertexId &id)
+{
+    if (text.empty() || text.size() > 20 || text.find_first_not_of("0123456789") != string::npos)
+    {
+        return false;
+    }
+    errno = 0;
+    id = strtoull(text.c_str(), nullptr, 10);
+    return errno == 0;
+}
+
+// What a K reports
+enum SccQueryMode
+{
+    SCC_LIST,     // Every SCC with its vertices
+    SCC_COUNT,    // The number of SCCs and the size of the largest
+    SCC_TOP,      // The sizes of the largest SCCs
+    SCC_HISTOGRAM // The number of SCCs of every size
+};
+
+// Which part of the graph a K searches
+enum SccRegion
+{
+    SCC_WHOLE,     // Every vertex
+    SCC_REACHABLE, // The vertices reachable from the query's vertex
+    SCC_SUBSET     // The subgraph induced by the query's vertices
+};
+
+// A K and its parameters
+struct SccQuery
+{
+    SccQueryMode mode = SCC_LIST;
+    size_t top = 0;           // Number of sizes reported by SCC_TOP
+    SccRegion region = SCC_WHOLE;
+    vector<VertexId> vertices; // The seed of SCC_REACHABLE, the vertices of SCC_SUBSET
+};
+
+// Parse the parameters of a K: an optional mode ("count", "top N" or
+// "histogram") followed by an optional region ("from v" or
+// "subset v1,v2,..."), each word separated by spaces; the commas of a subset
+// may have spaces around them. Returns false for anything else
+bool parse_scc_query(const string &params, SccQuery &query)
+{
+    query = SccQuery();
+    istringstream in(params);
+    string word;
+    VertexId id;
+    if (!(in >> word))
+    {
+        return true;
+    }
+    if (word == "count" || word == "histogram")
+    {
+        query.mode = word == "count" ? SCC_COUNT : SCC_HISTOGRAM;
+    }
+    else if (word == "top")
+    {
+        query.mode = SCC_TOP;
+        if (!(in >> word) || word.size() > 9 || !parse_vertex_id(word, id) || id == 0)
+        {
+            return false;
+        }
+        query.top = id;
+    }
+    if (query.mode != SCC_LIST && !(in >> word))
+    {
+        return true;
+    }
+
+    if (word == "from")
+    {
+        query.region = SCC_REACHABLE;
+        if (!(in >> word) || !parse_vertex_id(word, id))
+        {
+            return false;
+        }
+        query.vertices.push_back(id);
+    }
+    else if (word == "subset")
+    {
+        // The rest is the list: numbers with one comma between two of them
+        query.region = SCC_SUBSET;
+        string list;
+        getline(in, list);
+        size_t pos = 0;
+        do
+        {
+            size_t start = list.find_first_not_of(' ', pos);
+            size_t end = start == string::npos ? list.size() : list.find_first_of(" ,", start);
+            end = end == string::npos ? list.size() : end;
+            if (start == string::npos || !parse_vertex_id(list.substr(start, end - start), id))
+            {
+                return false;
+            }
+            query.vertices.push_back(id);
+            pos = list.find_first_not_of(' ', end);
+        } while (pos != string::npos && list[pos++] == ',');
+        return pos == string::npos;
+    }
+    else
+    {
+        return false;
+    }
+    return !(in >> word);
+}
+
 class Graph
 {
 private:
-    int vertices; // Number of vertices in the graph
+    int vertices; // Number of vertices in the graph (internal indices are 0..vertices-1)
     int max_css; // Maximum size of the Strongly Connected Components (SCCs)
-    vector<pair<int, int>> edgeList; // List of edges in the graph
-    vector<list<int>> adj; // Adjacency list for the graph
-    vector<list<int>> revAdj; // Reverse adjacency list for the graph
+    int scc_count; // Number of SCCs found by the last run of Kosaraju's algorithm
+    size_t edge_count; // Number of edges in the graph
+    StorageMode storage; // Which pair of adjacencies below holds the edges
+    ListAdjacency adj; // Adjacency lists for the graph, by internal index
+    ListAdjacency revAdj; // Reverse adjacency lists for the graph, by internal index
+    CompressedAdjacency packedAdj; // Compressed adjacency for the graph
+    CompressedAdjacency packedRevAdj; // Compressed reverse adjacency for the graph
+    vector<VertexId> ext_of; // Vertex number of every internal index
+    VertexDictionary ids; // Internal index of every vertex number
+    ReorderMode reorder_mode; // Relabeling applied before Kosaraju's algorithm
+    size_t edge_changes; // Edges added or removed since the last relabeling
 
     // Private constructor to prevent multiple instances
-    Graph() : vertices(0) {}
+    Graph() : vertices(0), max_css(0), scc_count(0), edge_count(0), storage(STORAGE_LIST),
+              reorder_mode(REORDER_NONE), edge_changes(0) {}
+
+    // Call f with the forward and reverse adjacency of the current storage
+    template <class F>
+    void withStorage(F f)
+    {
+        if (storage == STORAGE_COMPACT)
+        {
+            f(packedAdj, packedRevAdj);
+        }
+        else
+        {
+            f(adj, revAdj);
+        }
+    }
+
+    template <class F>
+    void withStorage(F f) const
+    {
+        if (storage == STORAGE_COMPACT)
+        {
+            f(packedAdj, packedRevAdj);
+        }
+        else
+        {
+            f(adj, revAdj);
+        }
+    }
 
-    // Depth First Search (DFS) function used for Kosaraju's algorithm
-    void dfs(int v, vector<bool> &visited, stack<int> &Stack)
+    // Kosaraju's algorithm on the part of the graph a query covers
+    template <bool List, class Emit>
+    bool runScc(const SccQuery &query, Emit emit, SccResult &result, SccControl *control) const
     {
-        visited[v] = true;
-        for (auto i = adj[v].begin(); i != adj[v].end(); ++i)
+        bool finished = false;
+        if (query.region == SCC_WHOLE)
         {
-            if (!visited[*i])
+            withStorage([&](const auto &g, const auto &rev)
+                        { finished = scc_run<List>(g, rev, vertices, emit, result, control); });
+            return finished;
+        }
+        vector<size_t> seeds;
+        seeds.reserve(query.vertices.size());
+        for (VertexId id : query.vertices)
+        {
+            long index = ids.find(id);
+            if (index != -1)
             {
-                dfs(*i, visited, Stack);
+                seeds.push_back(index);
             }
         }
-        Stack.push(v);
+        withStorage([&](const auto &g, const auto &rev)
+                    { finished = scc_run_region<List>(g, rev, vertices, seeds, query.region == SCC_SUBSET, emit,
+                                                      result, control); });
+        return finished;
     }
 
-    // Reverse DFS function used for Kosaraju's algorithm
-    void reverseDfs(int v, vector<bool> &visited, vector<int> &component)
+    // Breadth first search of a prepared graph from the internal index
+    // source; level(distance, frontier, visited) as for bfs_run()
+    // A run given a control reports the vertices reached there and stops
+    // (and returns false) after the level during which it was cancelled
+    template <class Level>
+    bool runBfs(int source, Level level, SccControl *control) const
     {
-        visited[v] = true;
-        component.push_back(v);
-        for (auto i = revAdj[v].begin(); i != revAdj[v].end(); ++i)
+        bool finished = true;
+        size_t reached = 0;
+        auto checked = [&](size_t distance, const vector<int> &frontier, const VisitedSet &visited)
         {
-            if (!visited[*i])
+            if (control != nullptr)
             {
-                reverseDfs(*i, visited, component);
+                reached += frontier.size();
+                control->progress.store(reached, memory_order_relaxed);
+                if (control->cancelled.load(memory_order_relaxed))
+                {
+                    finished = false;
+                    return false;
+                }
             }
+            return level(distance, frontier, visited);
+        };
+        withStorage([&](const auto &g, const auto &rev)
+                    { bfs_run(g, rev, vertices, edge_count, source, checked); });
+        return finished;
+    }
+
+    // Relabeling rebuilds every adjacency list, so it is only redone once
+    // more than an eighth of the edges changed since the last one
+    bool needsReorder() const
+    {
+        return edge_changes > edge_count / 8;
+    }
+
+    // Internal index of a vertex number, adding the vertex if it is new
+    // The arrays grow by doubling, so adding a vertex is amortized O(1)
+    int indexOf(VertexId id)
+    {
+        bool added;
+        int index = ids.insert(id, vertices, added);
+        if (added)
+        {
+            withStorage([](auto &g, auto &rev)
+                        {
+                            g.addVertex();
+                            rev.addVertex();
+                        });
+            ext_of.push_back(id);
+            vertices++;
         }
+        return index;
+    }
+
+    // Reverse Cuthill-McKee order: breadth first over the undirected graph,
+    // starting every tree at the unvisited vertex of lowest degree and taking
+    // neighbors by increasing degree, then reversed
+    // Vertices that are close in the graph end up close in memory
+    template <class Adjacency>
+    vector<int> bfsOrder(const Adjacency &g, const Adjacency &rev) const
+    {
+        vector<size_t> degree(vertices);
+        vector<int> by_degree(vertices);
+        for (int v = 0; v < vertices; v++)
+        {
+            degree[v] = g.degree(v) + rev.degree(v);
+            by_degree[v] = v;
+        }
+        auto lower_degree = [&degree](int a, int b)
+        { return degree[a] < degree[b]; };
+        stable_sort(by_degree.begin(), by_degree.end(), lower_degree);
+
+        vector<int> order;
+        vector<bool> seen(vertices, false);
+        vector<int> neighbors;
+        auto discover = [&](int w)
+        {
+            if (!seen[w])
+            {
+                seen[w] = true;
+                neighbors.push_back(w);
+            }
+        };
+        order.reserve(vertices);
+        for (int root : by_degree)
+        {
+            if (seen[root])
+            {
+                continue;
+            }
+            seen[root] = true;
+            size_t head = order.size();
+            order.push_back(root);
+            while (head < order.size())
+            {
+                int u = order[head++];
+                neighbors.clear();
+                g.forEach(u, discover);
+                rev.forEach(u, discover);
+                stable_sort(neighbors.begin(), neighbors.end(), lower_degree);
+                order.insert(order.end(), neighbors.begin(), neighbors.end());
+            }
+        }
+        reverse(order.begin(), order.end());
+        return order;
+    }
+
+    // Vertices by decreasing total degree: the hubs that most DFS paths go
+    // through share the first cache lines
+    template <class Adjacency>
+    vector<int> degreeOrder(const Adjacency &g, const Adjacency &rev) const
+    {
+        vector<size_t> degree(vertices);
+        vector<int> order(vertices);
+        for (int v = 0; v < vertices; v++)
+        {
+            degree[v] = g.degree(v) + rev.degree(v);
+            order[v] = v;
+        }
+        stable_sort(order.begin(), order.end(), [&degree](int a, int b)
+                    { return degree[a] > degree[b]; });
+        return order;
+    }
+
+    // Move every vertex to a new internal index; order[i] is the current index
+    // of the vertex that gets index i
+    // The adjacency is rebuilt in the new order, so the neighbors of vertices
+    // visited together are also stored together
+    template <class Adjacency>
+    void relabel(Adjacency &g, Adjacency &rev, const vector<int> &order)
+    {
+        vector<int> new_of_old(vertices);
+        vector<VertexId> newExt(vertices);
+        for (int i = 0; i < vertices; i++)
+        {
+            new_of_old[order[i]] = i;
+            newExt[i] = ext_of[order[i]];
+            ids.assign(newExt[i], i);
+        }
+        g.relabel(order, new_of_old);
+        rev.relabel(order, new_of_old);
+        ext_of.swap(newExt);
+    }
+
+    // Copy the edges of one storage into another, empty one
+    template <class From, class To>
+    void convert(From &g, From &rev, To &to_g, To &to_rev)
+    {
+        g.prepare();
+        to_g.clear(vertices);
+        to_rev.clear(vertices);
+        for (int v = 0; v < vertices; v++)
+        {
+            to_g.addVertex();
+            to_rev.addVertex();
+        }
+        for (int v = 0; v < vertices; v++)
+        {
+            g.forEach(v, [&](int w)
+                      {
+                          to_g.add(v, w);
+                          to_rev.add(w, v);
+                      });
+        }
+        to_g.prepare();
+        to_rev.prepare();
+        g.clear();
+        rev.clear();
     }
 
 public:
@@ -87,90 +469,432 @@ public:
     Graph(const Graph &) = delete;
     void operator=(const Graph &) = delete;
 
-    // Function to create a new graph with given vertices and edges
-    void newGraph(int v, int e)
+    // Function to create a new, empty graph with the vertices 1..v
+    // The front-end feeds the e edges that follow through newEdge; edges may
+    // also name vertices outside 1..v, which are added on first use
+    void newGraph(int v, int e, ostream &out)
     {
-        vertices = v;
-        edgeList.clear();
-        adj.clear();
-        adj.resize(vertices);
-        revAdj.clear();
-        revAdj.resize(vertices);
+        vertices = 0;
+        edge_count = 0;
+        withStorage([v](auto &g, auto &rev)
+                    {
+                        g.clear(v);
+                        rev.clear(v);
+                    });
+        ext_of.clear();
+        ext_of.reserve(v);
+        ids.clear(v);
+        for (int i = 1; i <= v; i++)
+        {
+            indexOf(i);
+        }
+        edge_changes = 0;
 
-        cout << "Enter the edges (format: u v):" << endl;
-        for (int i = 0; i < e; i++)
+        if (e > 0)
         {
-            int u, v;
-            cin >> u >> v;
-            newEdge(u, v);
+            out << "Enter the edges (format: u v):" << '\n';
+        }
+        else
+        {
+            out << "The graph was created successfully" << '\n';
         }
-        cin.ignore(numeric_limits<streamsize>::max(), '\n'); // Clear the input buffer
-        cout << "The graph was created successfully" << endl;
     }
 
     // Function to find and print all Strongly Connected Components (SCCs) using Kosaraju's algorithm
-    void kosaraju()
+    void kosaraju(ostream &out, const SccQuery &query = SccQuery())
     {
-        stack<int> Stack;
-        vector<bool> visited(vertices, false);
+        SccResult result;
+        prepareScc();
+        querySccs(query, out, result);
+        if (query.region == SCC_WHOLE)
+        {
+            setSccResult(result);
+        }
+    }
 
-        // Fill vertices in stack according to their finishing times
-        for (int i = 0; i < vertices; i++)
+    // Bring the storage up to date (pending reorder, logged changes) before
+    // computeScc; must not run while a computeScc is running
+    void prepareScc()
+    {
+        if (reorder_mode != REORDER_NONE && needsReorder())
+        {
+            reorder(reorder_mode);
+        }
+        withStorage([](auto &g, auto &rev)
+                    {
+                        g.prepare();
+                        rev.prepare();
+                    });
+    }
+
+    // Kosaraju's algorithm on a prepared graph; only reads the graph, so
+    // several runs may share it as long as nothing changes it meanwhile
+    // A run given a control reports its progress there and stops early (and
+    // returns false) once it is cancelled
+    // The query's region decides which part of the graph is searched
+    bool computeScc(const SccQuery &query, ostream &out, SccResult &result, SccControl *control = nullptr) const
+    {
+        auto print = [&](const auto &component)
         {
-            if (!visited[i])
+            out << "SCC:";
+            for (auto vertex : component)
+                out << " " << ext_of[vertex];
+            out << '\n';
+        };
+        return runScc<true>(query, print, result, control);
+    }
+
+    // Kosaraju's algorithm on a prepared graph without listing the vertices:
+    // emit(size) is called with the size of every SCC
+    template <class Emit>
+    bool computeSccSizes(const SccQuery &query, Emit emit, SccResult &result, SccControl *control = nullptr) const
+    {
+        return runScc<false>(query, emit, result, control);
+    }
+
+    // Answer a K on a prepared graph
+    // The summary modes only keep the sizes of the SCCs, so their answer is a
+    // few lines whatever the size of the graph; a K from or subset a few
+    // vertices only searches around them
+    bool querySccs(const SccQuery &query, ostream &out, SccResult &result, SccControl *control = nullptr) const
+    {
+        out << "Kosaraju on the current graph: " << '\n';
+        for (VertexId id : query.vertices)
+        {
+            if (ids.find(id) == -1)
             {
-                dfs(i, visited, Stack);
+                out << "Vertex " << id << " is not in the graph" << '\n';
             }
         }
+        if (query.mode == SCC_LIST)
+        {
+            return computeScc(query, out, result, control);
+        }
+        priority_queue<size_t, vector<size_t>, greater<size_t>> largest; // Smallest of the sizes kept on top
+        map<size_t, size_t> histogram;                                   // Number of SCCs of every size
+        auto keep = [&](size_t size)
+        {
+            if (query.mode == SCC_TOP)
+            {
+                if (largest.size() < query.top)
+                {
+                    largest.push(size);
+                }
+                else if (size > largest.top())
+                {
+                    largest.pop();
+                    largest.push(size);
+                }
+            }
+            else if (query.mode == SCC_HISTOGRAM)
+            {
+                histogram[size]++;
+            }
+        };
+        bool finished = computeSccSizes(query, keep, result, control);
+        if (!finished)
+        {
+            return false;
+        }
+        out << "SCCs: " << result.components << '\n';
+        if (query.mode == SCC_COUNT)
+        {
+            out << "Largest SCC: " << result.largest << '\n';
+        }
+        else if (query.mode == SCC_TOP)
+        {
+            vector<size_t> sizes;
+            for (; !largest.empty(); largest.pop())
+            {
+                sizes.push_back(largest.top());
+            }
+            out << "Largest SCCs:";
+            for (auto it = sizes.rbegin(); it != sizes.rend(); ++it)
+            {
+                out << " " << *it;
+            }
+            out << '\n';
+        }
+        else
+        {
+            for (const auto &entry : histogram)
+            {
+                out << "Size " << entry.first << ": " << entry.second << " SCCs" << '\n';
+            }
+        }
+        return true;
+    }
+
+    // Remember the summary of the last completed run
+    void setSccResult(const SccResult &result)
+    {
+        max_css = result.largest;
+        scc_count = result.components;
+    }
+
+    // List the SCCs of a prepared graph in topological order of the
+    // condensation: every edge between two SCCs goes from an SCC to one
+    // listed after it. The second pass of Kosaraju's algorithm finds them in
+    // that order
+    // Returns false if the run was cancelled, as computeScc does
+    bool topologicalOrder(ostream &out, SccControl *control = nullptr) const
+    {
+        SccResult result;
+        out << "Topological order of the SCCs:" << '\n';
+        return computeScc(SccQuery(), out, result, control);
+    }
 
-        // Reset visited array for second pass
-        fill(visited.begin(), visited.end(), false);
-        int largest_scc_size = 0;
-        
-        // Process all vertices in order defined by Stack
-        while (!Stack.empty())
+    // Tell whether a prepared graph has a cycle, and show one
+    // Returns false if the run was cancelled
+    bool hasCycle(ostream &out, SccControl *control = nullptr) const
+    {
+        vector<int> order;
+        vector<int> cycle;
+        bool acyclic = true;
+        withStorage([&](const auto &g, const auto &rev)
+                    { acyclic = topo_run(g, rev, vertices, order, cycle, control); });
+        if (!acyclic && cycle.empty())
+        {
+            return false;
+        }
+        if (acyclic)
         {
-            int v = Stack.top();
-            Stack.pop();
+            out << "The graph has no cycle" << '\n';
+            return true;
+        }
+        out << "The graph has a cycle:";
+        for (int vertex : cycle)
+        {
+            out << " " << ext_of[vertex];
+        }
+        out << '\n';
+        return true;
+    }
 
-            if (!visited[v])
+    // Print the vertices a prepared graph reaches from source, level by
+    // level, with their distance (in edges) from it
+    // Returns false if the run was cancelled
+    bool bfs(VertexId source, ostream &out, SccControl *control = nullptr) const
+    {
+        long from = ids.find(source);
+        if (from == -1)
+        {
+            out << "Vertex " << source << " is not in the graph" << '\n';
+            return true;
+        }
+        size_t reached = 0;
+        out << "BFS from " << source << ":" << '\n';
+        auto print = [&](size_t distance, const vector<int> &frontier, const VisitedSet &)
+        {
+            out << "Distance " << distance << ":";
+            for (int vertex : frontier)
             {
-                vector<int> component;
-                reverseDfs(v, visited, component);
-                largest_scc_size = max(largest_scc_size, static_cast<int>(component.size()));
-                cout << "SCC:";
-                for (int vertex : component)
-                    cout << " " << (vertex + 1);
-                cout << endl;
+                out << " " << ext_of[vertex];
             }
+            out << '\n';
+            reached += frontier.size();
+            return true;
+        };
+        if (!runBfs(from, print, control))
+        {
+            return false;
         }
-        this->max_css = largest_scc_size;
+        out << "Reached " << reached << " vertices" << '\n';
+        return true;
+    }
+
+    // Tell whether v can be reached from u in a prepared graph, and in how
+    // many edges; the search stops at the level where v is found
+    // Returns false if the run was cancelled
+    bool reach(VertexId u, VertexId v, ostream &out, SccControl *control = nullptr) const
+    {
+        long from = ids.find(u);
+        long to = ids.find(v);
+        if (from == -1 || to == -1)
+        {
+            out << "Vertex " << (from == -1 ? u : v) << " is not in the graph" << '\n';
+            return true;
+        }
+        long found = -1;
+        auto find = [&](size_t distance, const vector<int> &, const VisitedSet &visited)
+        {
+            if (visited.test(to))
+            {
+                found = distance;
+            }
+            return found == -1;
+        };
+        if (!runBfs(from, find, control))
+        {
+            return false;
+        }
+        if (found == -1)
+        {
+            out << "Vertex " << v << " is not reachable from " << u << '\n';
+        }
+        else
+        {
+            out << "Vertex " << v << " is reachable from " << u << " in " << found << " edges" << '\n';
+        }
+        return true;
     }
 
     // Function to add a new edge to the graph
-    void newEdge(int u, int v)
+    void newEdge(VertexId u, VertexId v, ostream &out)
+    {
+        int from = indexOf(u);
+        int to = indexOf(v);
+        withStorage([from, to](auto &g, auto &rev)
+                    {
+                        g.add(from, to);
+                        rev.add(to, from);
+                    });
+        edge_count++;
+        edge_changes++;
+        out << "The edge " << u << "," << v << " was added" << '\n';
+    }
+
+    // True if the graph has the vertex
+    bool hasVertex(VertexId id) const
+    {
+        return ids.find(id) != -1;
+    }
+
+    // Call f(id, degree) for every vertex, with its number of edges in and out
+    // The storage's logged changes are merged first, so no computeScc may run
+    template <class F>
+    void forEachVertex(F f)
+    {
+        withStorage([&](auto &g, auto &rev)
+                    {
+                        g.prepare();
+                        rev.prepare();
+                        for (int u = 0; u < vertices; u++)
+                        {
+                            f(ext_of[u], g.degree(u) + rev.degree(u));
+                        }
+                    });
+    }
+
+    // Call f(u, v) for every edge (once per copy of it), by vertex numbers
+    // The storage's logged changes are merged first, so no computeScc may run
+    template <class F>
+    void forEachEdge(F f)
+    {
+        withStorage([&](auto &g, auto &rev)
+                    {
+                        g.prepare();
+                        rev.prepare();
+                        for (int u = 0; u < vertices; u++)
+                        {
+                            g.forEach(u, [&](int w)
+                                      { f(ext_of[u], ext_of[w]); });
+                        }
+                    });
+    }
+
+    // True if the graph has the edge u,v (at least once)
+    bool hasEdge(VertexId u, VertexId v) const
+    {
+        long from = ids.find(u);
+        long to = ids.find(v);
+        size_t found = 0;
+        if (from != -1 && to != -1)
+        {
+            withStorage([from, to, &found](const auto &g, const auto &)
+                        { found = g.count(from, to); });
+        }
+        return found > 0;
+    }
+
+    // Function to remove an edge from the graph (all its copies, if it was
+    // added more than once)
+    void removeEdge(VertexId u, VertexId v, ostream &out)
     {
-        edgeList.emplace_back(u, v);
-        adj[u - 1].push_back(v - 1);
-        revAdj[v - 1].push_back(u - 1);
-        cout << "The edge " << u << "," << v << " was added" << endl;
+        long from = ids.find(u);
+        long to = ids.find(v);
+        size_t removed = 0;
+        if (from != -1 && to != -1)
+        {
+            withStorage([from, to, &removed](auto &g, auto &rev)
+                        {
+                            removed = g.removeAll(from, to);
+                            rev.removeAll(to, from);
+                        });
+        }
+        if (removed > 0)
+        {
+            edge_count -= removed;
+            edge_changes += removed;
+            out << "The edge " << u << "," << v << " was removed" << '\n';
+        }
+        else
+        {
+            out << "Edge " << u << "," << v << " not found" << '\n';
+        }
+    }
+
+    // Choose the relabeling applied before Kosaraju's algorithm
+    void setReorderMode(ReorderMode mode)
+    {
+        reorder_mode = mode;
+        edge_changes = edge_count + 1;
+    }
+
+    ReorderMode getReorderMode()
+    {
+        return reorder_mode;
+    }
+
+    // Relabel the vertices now; vertex numbers seen by the clients do not change
+    void reorder(ReorderMode mode)
+    {
+        withStorage([&](auto &g, auto &rev)
+                    {
+                        g.prepare();
+                        rev.prepare();
+                        if (mode == REORDER_BFS)
+                        {
+                            relabel(g, rev, bfsOrder(g, rev));
+                        }
+                        else if (mode == REORDER_DEGREE)
+                        {
+                            relabel(g, rev, degreeOrder(g, rev));
+                        }
+                    });
+        edge_changes = 0;
     }
 
-    // Function to remove an edge from the graph
-    void removeEdge(int u, int v)
+    // Move the edges to another storage
+    void setStorageMode(StorageMode mode)
     {
-        auto it = find(edgeList.begin(), edgeList.end(), make_pair(u, v));
-        if (it != edgeList.end())
+        if (mode == storage)
+        {
+            return;
+        }
+        if (mode == STORAGE_COMPACT)
         {
-            edgeList.erase(it);
-            adj[u - 1].remove(v - 1);
-            revAdj[v - 1].remove(u - 1);
-            cout << "The edge " << u << "," << v << " was removed" << endl;
+            convert(adj, revAdj, packedAdj, packedRevAdj);
         }
         else
         {
-            cout << "Edge " << u << "," << v << " not found" << endl;
+            convert(packedAdj, packedRevAdj, adj, revAdj);
         }
+        storage = mode;
+    }
+
+    StorageMode getStorageMode()
+    {
+        return storage;
+    }
+
+    // Approximate memory used by the edges, in bytes
+    size_t getAdjacencyBytes()
+    {
+        size_t bytes = 0;
+        withStorage([&](auto &g, auto &rev)
+                    { bytes = g.memoryBytes(edge_count) + rev.memoryBytes(edge_count); });
+        return bytes;
     }
 
     // Getter for the number of vertices in the graph
@@ -179,11 +903,23 @@ public:
         return vertices;
     }
 
+    // Getter for the number of edges in the graph
+    int getEdgeCount()
+    {
+        return edge_count;
+    }
+
     // Getter for the maximum size of the SCCs
     int get_max_scc()
     {
         return this->max_css;
     }
+
+    // Getter for the number of SCCs
+    int get_scc_count()
+    {
+        return this->scc_count;
+    }
 };
 
 #endif
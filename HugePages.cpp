@@ -0,0 +1,160 @@
+#ifndef HUGE_PAGES_H
+#define HUGE_PAGES_H
+
+#include <vector>
+#include <new>
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+
+// Huge pages for the graph's storage
+// A DFS over a large graph jumps between random rows of the adjacency arrays,
+// so with 4 KB pages nearly every step needs another TLB entry; with 2 MB
+// pages one entry covers 512 times more of the arrays
+// The arrays use HugePageAllocator: the blocks of HUGE_PAGE_SIZE or more are
+// mapped on their own, 2 MB aligned, and (depending on the mode) given huge
+// pages; smaller ones come from operator new as usual
+
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024) // Size of a huge page on x86-64 and arm64
+
+#ifndef MAP_HUGE_2MB
+#define MAP_HUGE_2MB (21 << 26) // MAP_HUGE_SHIFT is 26
+#endif
+
+// How the large blocks get huge pages
+enum HugePageMode
+{
+    HUGE_PAGES_OFF,         // 4 KB pages (madvise(MADV_NOHUGEPAGE), whatever the system default)
+    HUGE_PAGES_TRANSPARENT, // madvise(MADV_HUGEPAGE): the kernel backs them with huge pages when it can
+    HUGE_PAGES_EXPLICIT,    // MAP_HUGETLB from the reserved pool (vm.nr_hugepages), transparent if it is empty
+    HUGE_PAGES_COUNT
+};
+
+// Names of the modes for the -H option, in the order of HugePageMode
+const char *const huge_page_mode_names[HUGE_PAGES_COUNT] = {"off", "thp", "explicit"};
+
+// Mode of the large blocks allocated from now on, and what they got
+struct HugePageState
+{
+    std::atomic<int> mode{HUGE_PAGES_OFF};
+    std::atomic<uint64_t> explicit_bytes{0}; // Bytes mapped from the reserved pool
+    std::atomic<uint64_t> advised_bytes{0};  // Bytes madvised for transparent huge pages
+};
+
+HugePageState &huge_pages()
+{
+    static HugePageState state;
+    return state;
+}
+
+// Parse a mode name; returns HUGE_PAGES_COUNT if it is not one
+HugePageMode parse_huge_page_mode(const char *name)
+{
+    int mode = 0;
+    while (mode < HUGE_PAGES_COUNT && strcmp(name, huge_page_mode_names[mode]) != 0)
+    {
+        mode++;
+    }
+    return (HugePageMode)mode;
+}
+
+// Round a block size up to whole huge pages
+size_t huge_page_round(size_t bytes)
+{
+    return (bytes + HUGE_PAGE_SIZE - 1) & ~(size_t)(HUGE_PAGE_SIZE - 1);
+}
+
+// Map a large block of whole huge pages, 2 MB aligned so every page of it can
+// be a huge page; returns null if the memory is exhausted
+void *huge_page_map(size_t bytes)
+{
+    HugePageState &state = huge_pages();
+    size_t length = huge_page_round(bytes);
+    int mode = state.mode.load(std::memory_order_relaxed);
+    if (mode == HUGE_PAGES_EXPLICIT)
+    {
+        void *p = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_HUGE_2MB, -1, 0);
+        if (p != MAP_FAILED)
+        {
+            state.explicit_bytes.fetch_add(length, std::memory_order_relaxed);
+            return p;
+        }
+    }
+    // Map one huge page more and trim both ends to get the alignment
+    char *raw = static_cast<char *>(mmap(NULL, length + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE,
+                                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    if (raw == MAP_FAILED)
+    {
+        return nullptr;
+    }
+    char *p = reinterpret_cast<char *>(((uintptr_t)raw + HUGE_PAGE_SIZE - 1) & ~(uintptr_t)(HUGE_PAGE_SIZE - 1));
+    if (p > raw)
+    {
+        munmap(raw, p - raw);
+    }
+    munmap(p + length, raw + HUGE_PAGE_SIZE - p);
+    if (mode == HUGE_PAGES_OFF)
+    {
+        // Keep 4 KB pages even where transparent huge pages are "always"
+        madvise(p, length, MADV_NOHUGEPAGE);
+    }
+    else if (madvise(p, length, MADV_HUGEPAGE) == 0)
+    {
+        state.advised_bytes.fetch_add(length, std::memory_order_relaxed);
+    }
+    return p;
+}
+
+// Allocator of the graph's large arrays; see above
+// A block is mapped on its own when it is HUGE_PAGE_SIZE or larger, whatever
+// the mode (off only changes its advice), so deallocate() knows how to free it
+// from its size alone
+template <class T>
+struct HugePageAllocator
+{
+    typedef T value_type;
+
+    HugePageAllocator() = default;
+    template <class U>
+    HugePageAllocator(const HugePageAllocator<U> &) {}
+
+    T *allocate(size_t n)
+    {
+        size_t bytes = n * sizeof(T);
+        if (bytes < HUGE_PAGE_SIZE)
+        {
+            return static_cast<T *>(::operator new(bytes));
+        }
+        void *p = huge_page_map(bytes);
+        if (p == nullptr)
+        {
+            throw std::bad_alloc();
+        }
+        return static_cast<T *>(p);
+    }
+
+    void deallocate(T *p, size_t n)
+    {
+        size_t bytes = n * sizeof(T);
+        if (bytes < HUGE_PAGE_SIZE)
+        {
+            ::operator delete(p);
+            return;
+        }
+        munmap(p, huge_page_round(bytes));
+    }
+
+    template <class U>
+    bool operator==(const HugePageAllocator<U> &) const { return true; }
+    template <class U>
+    bool operator!=(const HugePageAllocator<U> &) const { return false; }
+};
+
+// A vector of the graph's storage
+template <class T>
+using HugeVector = std::vector<T, HugePageAllocator<T>>;
+
+#endif
@@ -0,0 +1,1182 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <charconv>
+#include <map>
+#include <set>
+#include <unordered_map>
+#include <memory>
+#include <atomic>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <deque>
+#include <vector>
+#include <iterator>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include "Buffers.cpp"
+#include "CommandParser.cpp"
+#include "Metrics.cpp"
+#include "libraries.cpp"
+
+// Wire protocol between the servers and the "./list -f" engine.
+//
+// The server tags every command line it forwards with the connection id of the
+// client that sent it and a per-connection request number:
+//     #<conn>.<seq> <command>\n
+// The engine answers every tagged line with one final frame:
+//     #<conn>.<seq> <payload length> end\n<payload>
+// possibly preceded by partial frames flagged "more" (a K answers "Job <id>
+// started" with one as soon as its job starts; the final frame follows when
+// the job is done). Since a K runs in the background, the answers to the
+// requests of a connection may complete out of order.
+// The engine publishes notifications that are not tied to a request as:
+//     #0.0 <payload length> note\n<payload>
+// Clients only receive the frames of their own requests, each followed by an
+// "END <seq>" marker (or "MORE <seq>" for a partial frame). Clients that sent
+// "Subscribe" also receive a copy of every other frame followed by a "NOTE"
+// marker.
+//
+// Besides tagged lines the server sends the engine control lines, which are
+// not answered:
+//     !closed <conn>\n    the client is gone; its running jobs are cancelled
+//     !pause <conn>\n     the client's output backed up; stop streaming to it
+//     !resume <conn>\n    the client caught up; streaming may go on
+// A K streams its SCCs in "more" frames of bounded size as they are found,
+// so a slow client holds up its own K (through !pause), never the engine or
+// the other clients.
+//
+// After a K changed the SCC summary of the graph, the engine publishes a note
+// whose first line is
+//     SCC update: largest=<n> components=<n> vertices=<n> majority=<yes|no>
+// followed by a sentence when the largest SCC crossed 50% of the graph.
+
+#define FRAME_END "end"   // Flag of the last frame of a response
+#define FRAME_MORE "more" // Flag of a partial frame, more of the response follows
+#define FRAME_NOTE "note" // Flag of a notification frame
+
+#define CLIENT_HIGH_WATER (1024 * 1024) // Output queued for a client at which its streams are paused
+#define CLIENT_LOW_WATER (256 * 1024)   // Output queued for a client at which they are resumed
+#define ROUTER_SHARDS 64                // Shards of the router's tables of clients
+#define ENGINE_QUEUE_HIGH_WATER (4 * 1024 * 1024) // Commands waiting for the engine at which client threads wait
+
+// Identifies a single request: the connection it came from and its number
+struct RequestTag
+{
+    uint64_t conn; // Connection id assigned by the server (0 for notifications)
+    uint64_t seq;  // Request number within the connection
+};
+
+// Split a tagged command line into its tag and the command itself
+// Returns false if the line does not start with a tag
+bool parse_request_tag(std::string_view line, RequestTag &tag, std::string_view &command)
+{
+    if (line.empty() || line[0] != '#')
+    {
+        return false;
+    }
+    const char *end = line.data() + line.size();
+    std::from_chars_result r = std::from_chars(line.data() + 1, end, tag.conn);
+    if (r.ec != std::errc() || r.ptr == end || *r.ptr != '.')
+    {
+        return false;
+    }
+    r = std::from_chars(r.ptr + 1, end, tag.seq);
+    if (r.ec != std::errc())
+    {
+        return false;
+    }
+    const char *p = r.ptr;
+    if (p < end && *p == ' ')
+    {
+        p++;
+    }
+    command = std::string_view(p, end - p);
+    return true;
+}
+
+bool parse_request_tag(const std::string &line, RequestTag &tag, std::string &command)
+{
+    std::string_view view;
+    if (!parse_request_tag(std::string_view(line), tag, view))
+    {
+        return false;
+    }
+    command.assign(view);
+    return true;
+}
+
+// Build the header line of a frame carrying payload_len bytes
+std::string format_frame_header(const RequestTag &tag, size_t payload_len, const char *flag)
+{
+    char header[96];
+    snprintf(header, sizeof header, "#%llu.%llu %zu %s\n",
+             (unsigned long long)tag.conn, (unsigned long long)tag.seq, payload_len, flag);
+    return header;
+}
+
+// Summary of the SCCs of the graph after a K, as published by the engine
+struct SccEvent
+{
+    int largest;           // Size of the largest SCC
+    int components;        // Number of SCCs
+    int vertices;          // Number of vertices of the graph
+    bool majority;         // True if the largest SCC holds more than half of the vertices
+    bool majority_changed; // True if majority differs from the previous summary
+};
+
+// Build the note published for an SCC summary
+std::string format_scc_note(const SccEvent &event)
+{
+    char line[160];
+    snprintf(line, sizeof line, "SCC update: largest=%d components=%d vertices=%d majority=%s\n",
+             event.largest, event.components, event.vertices, event.majority ? "yes" : "no");
+    std::string note = line;
+    if (event.majority_changed)
+    {
+        note += event.majority ? "At Least 50% of the graph belongs to the same SCC\n"
+                               : "At Least 50% of the graph no longer belongs to the same SCC\n";
+    }
+    return note;
+}
+
+// Parse a note published for an SCC summary
+// Returns false if the note is about something else
+bool parse_scc_note(const std::string &note, SccEvent &event)
+{
+    char majority[4] = "";
+    if (sscanf(note.c_str(), "SCC update: largest=%d components=%d vertices=%d majority=%3s",
+               &event.largest, &event.components, &event.vertices, majority) != 4)
+    {
+        return false;
+    }
+    event.majority = (strcmp(majority, "yes") == 0);
+    event.majority_changed = (note.find("At Least 50%") != std::string::npos);
+    return true;
+}
+
+// Accumulates a byte stream and hands out complete lines
+class LineAssembler
+{
+private:
+    std::string pending; // Bytes received after the last newline
+
+public:
+    // Feed received bytes, calling on_line for every complete line (without the newline)
+    // The lines are std::string_views into buf (or into the assembler for a
+    // line split across reads), valid during the call only
+    template <typename Func>
+    void feed(const char *buf, size_t len, Func on_line)
+    {
+        if (!pending.empty())
+        {
+            // Finish the line the previous bytes started
+            const char *newline = static_cast<const char *>(memchr(buf, '\n', len));
+            if (newline == nullptr)
+            {
+                pending.append(buf, len);
+                return;
+            }
+            size_t head = newline + 1 - buf;
+            pending.append(buf, head);
+            for_each_line(pending.data(), pending.size(), on_line);
+            pending.clear();
+            buf += head;
+            len -= head;
+        }
+        size_t used = for_each_line(buf, len, on_line);
+        pending.append(buf + used, len - used);
+    }
+};
+
+// Parses the frames printed by the engine
+// Payloads are handed out piece by piece as they arrive, straight from the
+// caller's buffer, so a large response is never reassembled in memory
+class FrameParser
+{
+private:
+    std::string header;      // Partial header line of the next frame
+    bool in_payload = false; // True once the header of the current frame was parsed
+    RequestTag tag;          // Tag of the current frame
+    std::string flag;        // Flag of the current frame
+    size_t payload_left = 0; // Payload bytes of the current frame not yet received
+
+    // Parse a complete header line; returns false if it is not a frame header
+    bool parse_header()
+    {
+        std::string rest;
+        if (!parse_request_tag(header, tag, rest))
+        {
+            std::cerr << "protocol: dropping unframed engine output: " << header << "\n";
+            return false;
+        }
+        char flag_buf[16] = "";
+        unsigned long long len_field = 0;
+        sscanf(rest.c_str(), "%llu %15s", &len_field, flag_buf);
+        payload_left = len_field;
+        flag = flag_buf;
+        return true;
+    }
+
+public:
+    // Feed engine output, calling on_data(tag, flag, data, len, done) for every
+    // piece of payload; done is true on the last piece of a frame (which may be empty)
+    template <typename Func>
+    void feed(const char *buf, size_t len, Func on_data)
+    {
+        while (len > 0 || (in_payload && payload_left == 0))
+        {
+            if (!in_payload)
+            {
+                const char *newline = (const char *)memchr(buf, '\n', len);
+                if (newline == NULL)
+                {
+                    header.append(buf, len);
+                    return;
+                }
+                header.append(buf, newline - buf);
+                len -= newline + 1 - buf;
+                buf = newline + 1;
+                in_payload = parse_header();
+                header.clear();
+                continue;
+            }
+            size_t n = std::min(len, payload_left);
+            payload_left -= n;
+            if (payload_left == 0)
+            {
+                in_payload = false;
+            }
+            on_data(tag, flag, buf, n, payload_left == 0);
+            buf += n;
+            len -= n;
+        }
+    }
+};
+
+// Buffers tagged command lines on their way to the engine's stdin so that the
+// commands of all clients that arrive together are written with a single write()
+// The event loops queue() commands and flush() them from their own thread into
+// a non blocking stdin. The threaded servers submit() them to a writer thread
+// that owns the stdin: submitting never writes, so a client thread never ends
+// up writing the commands of the others into a full pipe
+class EngineWriter
+{
+public:
+    // Completion handle of a submit(): wait() returns once its commands were written
+    struct Completion
+    {
+        bool done = false; // Set by the writer thread under done_lock
+    };
+
+private:
+    // The commands of one submit(), a link of the writer thread's queue
+    struct Node
+    {
+        std::atomic<Node *> next{nullptr}; // Next submit(), null while it is the last
+        std::string commands;              // Tagged command lines
+        Completion *completion = nullptr;  // Handle to signal once written, if any
+    };
+
+    int fd;                // The engine's stdin
+    pthread_mutex_t lock;  // Protects pending
+    std::string pending;   // Commands queued and not yet flushed
+
+    // Lock free queue of many submitters and one reader (Vyukov's intrusive
+    // MPSC queue): a submitter swaps itself in as the tail and then links the
+    // previous tail to it; the writer thread follows the links from head
+    std::atomic<Node *> tail;           // Last submit()
+    Node *head;                         // Last node written (its commands are gone); writer thread only
+    std::atomic<int64_t> submitted{0};  // Bytes submitted and not written yet
+    std::atomic<bool> sleeping{false};  // True while the writer thread waits for work
+    std::atomic<bool> stopping{false};  // True once the writer thread must end
+    int wake_fd = -1;                   // eventfd that wakes the writer thread
+    bool started = false;               // True once the writer thread runs
+    pthread_t thread;                   // The writer thread
+    pthread_mutex_t done_lock;          // Protects the completions and done_cond
+    pthread_cond_t done_cond;           // Signalled when completions are done
+
+    static void *writer_main(void *arg)
+    {
+        static_cast<EngineWriter *>(arg)->run();
+        return NULL;
+    }
+
+    // Body of the writer thread: write everything submitted since the last
+    // round with one write(), then signal the completions of that batch
+    void run()
+    {
+        std::vector<Completion *> completions;
+        while (true)
+        {
+            std::string batch;
+            completions.clear();
+            Node *next;
+            while ((next = head->next.load(std::memory_order_acquire)) != nullptr)
+            {
+                if (batch.empty())
+                {
+                    batch.swap(next->commands);
+                }
+                else
+                {
+                    batch += next->commands;
+                    std::string().swap(next->commands);
+                }
+                if (next->completion != nullptr)
+                {
+                    completions.push_back(next->completion);
+                }
+                delete head;
+                head = next;
+            }
+            if (batch.empty())
+            {
+                if (stopping.load())
+                {
+                    return;
+                }
+                // Submitters wake the thread only once it says it sleeps, so
+                // look at the queue again after saying so
+                sleeping.store(true);
+                if (head->next.load() != nullptr || stopping.load())
+                {
+                    sleeping.store(false);
+                    continue;
+                }
+                uint64_t count;
+                if (read(wake_fd, &count, sizeof count) == -1 && errno != EINTR)
+                {
+                    perror("read");
+                    return;
+                }
+                continue;
+            }
+            submitted.fetch_sub(batch.size());
+            server_metrics().engine_input_queued.add(-(int64_t)batch.size());
+            size_t written = 0;
+            while (written < batch.size())
+            {
+                ssize_t n = write(fd, batch.data() + written, batch.size() - written);
+                if (n == -1)
+                {
+                    if (errno == EINTR)
+                    {
+                        continue;
+                    }
+                    perror("write");
+                    break; // The engine is gone, drop the batch
+                }
+                written += n;
+            }
+            if (!completions.empty())
+            {
+                pthread_mutex_lock(&done_lock);
+                for (Completion *completion : completions)
+                {
+                    completion->done = true;
+                }
+                pthread_cond_broadcast(&done_cond);
+                pthread_mutex_unlock(&done_lock);
+            }
+        }
+    }
+
+public:
+    EngineWriter(int fd) : fd(fd)
+    {
+        pthread_mutex_init(&lock, NULL);
+        pthread_mutex_init(&done_lock, NULL);
+        pthread_cond_init(&done_cond, NULL);
+        head = new Node; // The queue always holds a node the writer is done with
+        tail.store(head);
+    }
+
+    ~EngineWriter()
+    {
+        if (started)
+        {
+            stopping.store(true);
+            uint64_t one = 1;
+            if (write(wake_fd, &one, sizeof one) == -1)
+            {
+                perror("write");
+            }
+            pthread_join(thread, NULL);
+            close(wake_fd);
+        }
+        while (head != nullptr)
+        {
+            Node *next = head->next.load();
+            delete head;
+            head = next;
+        }
+        pthread_cond_destroy(&done_cond);
+        pthread_mutex_destroy(&done_lock);
+        pthread_mutex_destroy(&lock);
+    }
+
+    EngineWriter(const EngineWriter &) = delete;
+    void operator=(const EngineWriter &) = delete;
+
+    // Start the writer thread, before the first submit()
+    void start()
+    {
+        wake_fd = eventfd(0, EFD_CLOEXEC);
+        if (wake_fd == -1 || pthread_create(&thread, NULL, writer_main, this) != 0)
+        {
+            perror("engine writer");
+            exit(1);
+        }
+        started = true;
+    }
+
+    // Append commands to the batch; they are written by the next flush()
+    void queue(const std::string &commands)
+    {
+        pthread_mutex_lock(&lock);
+        pending += commands;
+        server_metrics().engine_input_queued.add(commands.size());
+        pthread_mutex_unlock(&lock);
+    }
+
+    // Write as much of the batch as the (non blocking) stdin accepts
+    // Returns true once the batch is empty
+    bool flush()
+    {
+        pthread_mutex_lock(&lock);
+        size_t written = 0;
+        while (written < pending.size())
+        {
+            ssize_t n = write(fd, pending.data() + written, pending.size() - written);
+            if (n == -1)
+            {
+                if (errno != EAGAIN && errno != EWOULDBLOCK)
+                {
+                    perror("write");
+                    written = pending.size(); // The engine is gone, drop the batch
+                }
+                break;
+            }
+            written += n;
+        }
+        pending.erase(0, written);
+        server_metrics().engine_input_queued.add(-(int64_t)written);
+        bool empty = pending.empty();
+        pthread_mutex_unlock(&lock);
+        return empty;
+    }
+
+    // Hand commands to the writer thread, from any thread; never blocks
+    // The commands of one thread reach the engine in the order they were
+    // submitted; completion, if given, is signalled once they were written
+    void submit(const std::string &commands, Completion *completion = nullptr)
+    {
+        if (commands.empty() && completion == nullptr)
+        {
+            return;
+        }
+        Node *node = new Node;
+        node->commands = commands;
+        node->completion = completion;
+        submitted.fetch_add(commands.size());
+        server_metrics().engine_input_queued.add(commands.size());
+        Node *prev = tail.exchange(node, std::memory_order_acq_rel);
+        prev->next.store(node, std::memory_order_release);
+        if (sleeping.exchange(false))
+        {
+            uint64_t one = 1;
+            if (write(wake_fd, &one, sizeof one) == -1)
+            {
+                perror("write");
+            }
+        }
+    }
+
+    // Wait until the commands of a submit() were written
+    void wait(Completion &completion)
+    {
+        pthread_mutex_lock(&done_lock);
+        while (!completion.done)
+        {
+            pthread_cond_wait(&done_cond, &done_lock);
+        }
+        pthread_mutex_unlock(&done_lock);
+    }
+
+    // Submit commands, then wait for them to be written if the writer thread
+    // is far behind, so a client that sends faster than the engine reads is
+    // held back instead of queueing without bound
+    void submit_throttled(const std::string &commands)
+    {
+        if (submitted.load() < ENGINE_QUEUE_HIGH_WATER)
+        {
+            submit(commands);
+            return;
+        }
+        Completion completion;
+        submit(commands, &completion);
+        wait(completion);
+    }
+};
+
+// Routes requests from clients to the engine and the engine's frames back to the clients
+// Nothing is locked for the whole router: every client has its own lock, the
+// tables that find a client by socket or connection id are split in shards
+// locked just for the lookup, and the subscribers the engine's frames are
+// fanned out to are an immutable list that is replaced, not changed, so
+// client threads and the thread reading the engine only meet on a client
+// they both use
+class Router
+{
+private:
+    // A request sent to the engine and not answered yet
+    struct InFlight
+    {
+        uint64_t seq;      // Number of the request
+        uint64_t start_ns; // When it was sent to the engine
+        CommandType type;  // Kind of command
+    };
+
+    // State kept for every connected client
+    struct Client
+    {
+        pthread_mutex_t lock;         // Protects everything below
+        uint64_t conn = 0;            // Connection id
+        int fd = -1;                  // Client socket
+        uint64_t next_seq = 1;        // Number of the next request of this client
+        bool subscribed = false;      // True if the client receives every frame
+        bool scrape = false;          // True for a metrics scrape, closed after its answer
+        bool dirty = false;           // True if output was queued since the last flush
+        bool paused = false;          // True if the engine was asked to pause its streams
+        bool backlogged = false;      // True if the socket did not take all the output
+        bool closed = false;          // True once removed: the socket may be another client's by now
+        size_t queued_reported = 0;   // Output bytes counted in the output_queued gauge
+        LineAssembler lines;          // Partial command line received from the client
+        OutputQueue out;              // Responses waiting to be written
+        std::deque<InFlight> pending; // Requests sent to the engine, oldest first
+
+        Client() { pthread_mutex_init(&lock, NULL); }
+        ~Client() { pthread_mutex_destroy(&lock); }
+        Client(const Client &) = delete;
+        void operator=(const Client &) = delete;
+    };
+
+    using ClientPtr = std::shared_ptr<Client>;
+    using ClientList = std::vector<ClientPtr>;
+
+    // Part of a table of clients, with the keys hashing to it
+    struct Shard
+    {
+        pthread_mutex_t lock;                         // Protects clients
+        std::unordered_map<uint64_t, ClientPtr> clients; // Clients by key
+
+        Shard() { pthread_mutex_init(&lock, NULL); }
+    };
+
+    Shard by_conn[ROUTER_SHARDS];                 // Clients by connection id
+    Shard by_fd[ROUTER_SHARDS];                   // Clients by socket
+    std::atomic<uint64_t> next_conn{1};           // Connection id of the next client
+    pthread_mutex_t subscribers_lock;             // Serializes the changes of subscribers
+    std::shared_ptr<const ClientList> subscribers; // The subscribed clients, replaced on every change
+    pthread_mutex_t backlog_lock;                 // Protects backlogged
+    std::set<int> backlogged;                     // Sockets of the clients with output waiting
+    pthread_mutex_t engine_lock;                  // Protects frames and note
+    FrameParser frames;                           // Parser for the engine's output
+    std::string note;                             // Note frame being received
+
+    static Shard &shard(Shard *table, uint64_t key)
+    {
+        return table[key % ROUTER_SHARDS];
+    }
+
+    // Find a client in a table; null if it is not there
+    static ClientPtr find(Shard *table, uint64_t key)
+    {
+        Shard &s = shard(table, key);
+        pthread_mutex_lock(&s.lock);
+        auto it = s.clients.find(key);
+        ClientPtr client = it == s.clients.end() ? nullptr : it->second;
+        pthread_mutex_unlock(&s.lock);
+        return client;
+    }
+
+    static void insert(Shard *table, uint64_t key, const ClientPtr &client)
+    {
+        Shard &s = shard(table, key);
+        pthread_mutex_lock(&s.lock);
+        s.clients[key] = client;
+        pthread_mutex_unlock(&s.lock);
+    }
+
+    // Remove a client from a table, unless another one took its key meanwhile
+    static void erase(Shard *table, uint64_t key, const ClientPtr &client)
+    {
+        Shard &s = shard(table, key);
+        pthread_mutex_lock(&s.lock);
+        auto it = s.clients.find(key);
+        if (it != s.clients.end() && it->second == client)
+        {
+            s.clients.erase(it);
+        }
+        pthread_mutex_unlock(&s.lock);
+    }
+
+    // Publish a subscriber list with a client added or removed
+    // Readers keep the list they loaded alive for as long as they use it
+    void set_subscribed(const ClientPtr &client, bool subscribed)
+    {
+        pthread_mutex_lock(&subscribers_lock);
+        std::shared_ptr<const ClientList> current = std::atomic_load(&subscribers);
+        auto list = std::make_shared<ClientList>();
+        list->reserve(current->size() + 1);
+        for (const ClientPtr &other : *current)
+        {
+            if (other != client)
+            {
+                list->push_back(other);
+            }
+        }
+        if (subscribed)
+        {
+            list->push_back(client);
+        }
+        std::atomic_store(&subscribers, std::shared_ptr<const ClientList>(std::move(list)));
+        pthread_mutex_unlock(&subscribers_lock);
+    }
+
+    // Record whether a client has output waiting
+    void set_backlogged(Client &client, bool backlog)
+    {
+        if (client.backlogged == backlog)
+        {
+            return;
+        }
+        client.backlogged = backlog;
+        pthread_mutex_lock(&backlog_lock);
+        if (backlog)
+        {
+            backlogged.insert(client.fd);
+        }
+        else
+        {
+            backlogged.erase(client.fd);
+        }
+        pthread_mutex_unlock(&backlog_lock);
+        if (backlog)
+        {
+            // Let a thread that waits for writable sockets watch this one too
+            uint64_t one = 1;
+            if (write(backlog_fd, &one, sizeof one) == -1)
+            {
+                perror("write");
+            }
+        }
+    }
+
+    // Queue bytes for a client
+    static void queue(Client &client, const char *data, size_t len)
+    {
+        client.out.append(data, len);
+        client.dirty = true;
+    }
+
+    static void queue(Client &client, const std::string &data)
+    {
+        queue(client, data.data(), data.size());
+    }
+
+    // Handle a command that is answered by the server itself
+    // Returns false if the command must be forwarded to the engine
+    bool handle_local(const ClientPtr &client, uint64_t seq, std::string_view command)
+    {
+        if (command == "Subscribe")
+        {
+            if (!client->subscribed)
+            {
+                client->subscribed = true;
+                set_subscribed(client, true);
+            }
+            queue(*client, "Subscribed to notifications\nEND " + std::to_string(seq) + "\n");
+            return true;
+        }
+        if (command == "Unsubscribe")
+        {
+            if (client->subscribed)
+            {
+                client->subscribed = false;
+                set_subscribed(client, false);
+            }
+            queue(*client, "Unsubscribed from notifications\nEND " + std::to_string(seq) + "\n");
+            return true;
+        }
+        return false;
+    }
+
+    // Mark a client gone, keeping the gauges right; called with its lock held
+    // and before its socket is closed
+    void retire(Client &client)
+    {
+        ServerMetrics &metrics = server_metrics();
+        client.closed = true;
+        client.out.abandon(client.fd);
+        metrics.connections_open.add(-1);
+        metrics.requests_in_flight.add(-(int64_t)client.pending.size());
+        metrics.output_queued.add(-(int64_t)client.queued_reported);
+        set_backlogged(client, false);
+    }
+
+    // Remove a retired client from the tables; called without its lock
+    void unregister(const ClientPtr &client)
+    {
+        erase(by_conn, client->conn, client);
+        erase(by_fd, client->fd, client);
+        if (client->subscribed)
+        {
+            set_subscribed(client, false);
+        }
+    }
+
+    // Account for the answer of one of a client's requests
+    // Most requests complete in order, so the search starts at the oldest
+    // A Stats answer gets the server's own statistics appended
+    void complete_request(Client &client, uint64_t seq)
+    {
+        ServerMetrics &metrics = server_metrics();
+        for (auto it = client.pending.begin(); it != client.pending.end(); ++it)
+        {
+            if (it->seq == seq)
+            {
+                metrics.requests_in_flight.add(-1);
+                metrics.latency_us[it->type].record((now_ns() - it->start_ns) / 1000);
+                if (it->type == CMD_STATS)
+                {
+                    queue(client, metrics.render());
+                }
+                client.pending.erase(it);
+                return;
+            }
+        }
+    }
+
+    // Write as much of a client's output as its socket takes without blocking;
+    // called with its lock held
+    // Pauses the engine's streams to the client while its output is backed up,
+    // adding the control lines for that to control
+    // Returns false if the client was a scrape that got its whole answer and
+    // was closed, and must be unregistered
+    bool flush_client(Client &client, std::string &control)
+    {
+        ServerMetrics &metrics = server_metrics();
+        size_t before = client.out.size();
+        uint32_t zerocopy_before = client.out.zerocopy_count();
+        client.out.flush(client.fd);
+        size_t after = client.out.size();
+        metrics.bytes_out.add(before - after);
+        metrics.zerocopy_sends.add(client.out.zerocopy_count() - zerocopy_before);
+        metrics.output_queued.add((int64_t)after - (int64_t)client.queued_reported);
+        client.queued_reported = after;
+        client.dirty = false;
+        set_backlogged(client, after > 0);
+        if (!client.paused && after >= CLIENT_HIGH_WATER)
+        {
+            client.paused = true;
+            control += "!pause " + std::to_string(client.conn) + "\n";
+        }
+        else if (client.paused && after <= CLIENT_LOW_WATER)
+        {
+            client.paused = false;
+            control += "!resume " + std::to_string(client.conn) + "\n";
+        }
+        if (client.scrape && client.pending.empty() && after == 0)
+        {
+            // A scrape connection is closed once it got its answer
+            retire(client);
+            close(client.fd);
+            return false;
+        }
+        return true;
+    }
+
+    // Flush a client unless it is gone, unregistering a finished scrape
+    void flush_and_check(const ClientPtr &client, std::string &control)
+    {
+        pthread_mutex_lock(&client->lock);
+        bool keep = client->closed || flush_client(*client, control);
+        pthread_mutex_unlock(&client->lock);
+        if (!keep)
+        {
+            unregister(client);
+        }
+    }
+
+    // Queue a slice of an engine buffer for a client, remembering in touched
+    // the clients that must be flushed
+    static void forward(const ClientPtr &client, IOBuffer *buf, size_t off, size_t len, std::vector<ClientPtr> &touched)
+    {
+        if (client->closed)
+        {
+            return;
+        }
+        if (!client->dirty)
+        {
+            touched.push_back(client);
+        }
+        client->out.append_shared(buf, off, len);
+        client->dirty = true;
+    }
+
+    // Register a client socket
+    ClientPtr register_client(int fd, bool scrape)
+    {
+        ClientPtr client = std::make_shared<Client>();
+        client->conn = next_conn.fetch_add(1, std::memory_order_relaxed);
+        client->fd = fd;
+        client->scrape = scrape;
+        if (zerocopy && !scrape)
+        {
+            client->out.enable_zerocopy(fd);
+        }
+        insert(by_conn, client->conn, client);
+        insert(by_fd, fd, client);
+        server_metrics().connections_open.add(1);
+        server_metrics().connections_total.add();
+        return client;
+    }
+
+public:
+    EventChannel<SccEvent, 64> scc_events; // SCC summaries published by the engine
+    int backlog_fd;                        // eventfd signalled when a client gets a backlog
+    bool zerocopy = false;                 // Send the clients' large writes with MSG_ZEROCOPY (set before serving)
+
+    Router() : subscribers(std::make_shared<const ClientList>())
+    {
+        pthread_mutex_init(&subscribers_lock, NULL);
+        pthread_mutex_init(&backlog_lock, NULL);
+        pthread_mutex_init(&engine_lock, NULL);
+        backlog_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    }
+
+    ~Router()
+    {
+        close(backlog_fd);
+        pthread_mutex_destroy(&engine_lock);
+        pthread_mutex_destroy(&backlog_lock);
+        pthread_mutex_destroy(&subscribers_lock);
+    }
+
+    // Register a newly accepted client socket
+    void add_client(int fd)
+    {
+        register_client(fd, false);
+    }
+
+    // Register a connection to the metrics scrape port
+    // It is answered like a "Stats" command and closed by the router afterwards
+    // Returns the command line that must be written to the engine's stdin
+    std::string add_scrape_client(int fd)
+    {
+        register_client(fd, true);
+        return on_client_data(fd, "Stats\n", 6);
+    }
+
+    // Forget a client socket; frames still pending for it are dropped
+    // Must be called before the socket is closed
+    // Returns the control line that must be written to the engine's stdin
+    // (empty if the client had no request in flight)
+    std::string remove_client(int fd)
+    {
+        std::string to_engine;
+        ClientPtr client = find(by_fd, fd);
+        if (client == nullptr)
+        {
+            return to_engine;
+        }
+        pthread_mutex_lock(&client->lock);
+        bool removed = !client->closed;
+        if (removed)
+        {
+            if (!client->pending.empty())
+            {
+                to_engine = "!closed " + std::to_string(client->conn) + "\n";
+            }
+            retire(*client);
+        }
+        pthread_mutex_unlock(&client->lock);
+        if (removed)
+        {
+            unregister(client);
+        }
+        return to_engine;
+    }
+
+    // Release the buffers of a client's completed zerocopy sends, when its
+    // socket woke a poller with nothing to read (see OutputQueue::reap())
+    void on_client_idle_wakeup(int fd)
+    {
+        ClientPtr client = find(by_fd, fd);
+        if (client == nullptr)
+        {
+            return;
+        }
+        pthread_mutex_lock(&client->lock);
+        if (!client->closed)
+        {
+            client->out.reap(fd);
+        }
+        pthread_mutex_unlock(&client->lock);
+    }
+
+    // Handle bytes received from a client
+    // Returns the tagged command lines that must be written to the engine's stdin
+    std::string on_client_data(int fd, const char *buf, size_t len)
+    {
+        std::string to_engine;
+        std::string control;
+        server_metrics().bytes_in.add(len);
+        ClientPtr client = find(by_fd, fd);
+        if (client == nullptr)
+        {
+            return to_engine;
+        }
+        pthread_mutex_lock(&client->lock);
+        bool keep = true;
+        if (!client->closed)
+        {
+            uint64_t conn = client->conn;
+            client->lines.feed(buf, len, [&](std::string_view command)
+                               {
+                                   if (command.empty())
+                                   {
+                                       return;
+                                   }
+                                   uint64_t seq = client->next_seq++;
+                                   CommandType type = classify_command(command);
+                                   server_metrics().requests[type].add();
+                                   if (!handle_local(client, seq, command))
+                                   {
+                                       to_engine += "#" + std::to_string(conn) + "." + std::to_string(seq) + " ";
+                                       to_engine += command;
+                                       to_engine += '\n';
+                                       client->pending.push_back({seq, now_ns(), type});
+                                       server_metrics().requests_in_flight.add(1);
+                                   }
+                               });
+            if (client->dirty)
+            {
+                keep = flush_client(*client, control);
+            }
+        }
+        pthread_mutex_unlock(&client->lock);
+        if (!keep)
+        {
+            unregister(client);
+        }
+        return to_engine + control;
+    }
+
+    // Handle the buffers filled by a read of the engine's stdout
+    // Every piece of a frame is queued by reference for its owner and the
+    // subscribers, so fanning a response out to many clients copies nothing;
+    // then each client that got output is written once with a gathered sendmsg()
+    // Returns the control lines that must be written to the engine's stdin
+    std::string on_engine_data(IOBuffer *const *bufs, int count)
+    {
+        std::vector<ClientPtr> touched; // Clients that got output, each once
+        std::shared_ptr<const ClientList> subs = std::atomic_load(&subscribers);
+        ClientPtr owner;                // Owner of the last frame, looked up once per frame
+        pthread_mutex_lock(&engine_lock);
+        for (int i = 0; i < count; i++)
+        {
+            IOBuffer *buf = bufs[i];
+            frames.feed(buf->data, buf->len,
+                        [&](const RequestTag &tag, const std::string &flag, const char *data, size_t len, bool done)
+                        {
+                            size_t off = data - buf->data;
+                            bool is_note = (flag == FRAME_NOTE);
+                            if (is_note)
+                            {
+                                // Notes are also published to the server's own subscribers
+                                note.append(data, len);
+                                SccEvent event;
+                                if (done && parse_scc_note(note, event))
+                                {
+                                    scc_events.publish(event);
+                                }
+                                if (done)
+                                {
+                                    note.clear();
+                                }
+                            }
+                            else
+                            {
+                                if (owner == nullptr || owner->conn != tag.conn)
+                                {
+                                    owner = find(by_conn, tag.conn);
+                                }
+                                if (owner != nullptr)
+                                {
+                                    pthread_mutex_lock(&owner->lock);
+                                    forward(owner, buf, off, len, touched);
+                                    if (!owner->closed && done && flag == FRAME_END)
+                                    {
+                                        complete_request(*owner, tag.seq);
+                                        queue(*owner, "END " + std::to_string(tag.seq) + "\n");
+                                    }
+                                    else if (!owner->closed && done && flag == FRAME_MORE)
+                                    {
+                                        queue(*owner, "MORE " + std::to_string(tag.seq) + "\n");
+                                    }
+                                    pthread_mutex_unlock(&owner->lock);
+                                }
+                            }
+                            for (const ClientPtr &sub : *subs)
+                            {
+                                if (sub->conn != tag.conn)
+                                {
+                                    pthread_mutex_lock(&sub->lock);
+                                    forward(sub, buf, off, len, touched);
+                                    if (!sub->closed && done)
+                                    {
+                                        queue(*sub, "NOTE\n", 5);
+                                    }
+                                    pthread_mutex_unlock(&sub->lock);
+                                }
+                            }
+                        });
+        }
+        pthread_mutex_unlock(&engine_lock);
+        std::string to_engine;
+        for (const ClientPtr &client : touched)
+        {
+            flush_and_check(client, to_engine);
+        }
+        return to_engine;
+    }
+
+    // Write more of a client's output once its socket is writable
+    // Returns the control lines that must be written to the engine's stdin
+    std::string on_client_writable(int fd)
+    {
+        std::string to_engine;
+        ClientPtr client = find(by_fd, fd);
+        if (client != nullptr)
+        {
+            flush_and_check(client, to_engine);
+        }
+        return to_engine;
+    }
+
+    // True if a client has output its socket did not take yet
+    bool has_backlog(int fd)
+    {
+        ClientPtr client = find(by_fd, fd);
+        if (client == nullptr)
+        {
+            return false;
+        }
+        pthread_mutex_lock(&client->lock);
+        bool backlog = client->out.size() > 0;
+        pthread_mutex_unlock(&client->lock);
+        return backlog;
+    }
+
+    // True if a client waits for answers or has output its socket did not take yet
+    bool is_busy(int fd)
+    {
+        ClientPtr client = find(by_fd, fd);
+        if (client == nullptr)
+        {
+            return false;
+        }
+        pthread_mutex_lock(&client->lock);
+        bool busy = !client->pending.empty() || client->out.size() > 0;
+        pthread_mutex_unlock(&client->lock);
+        return busy;
+    }
+
+    // The sockets of the clients that have output waiting
+    std::vector<int> backlogged_fds()
+    {
+        pthread_mutex_lock(&backlog_lock);
+        std::vector<int> fds(backlogged.begin(), backlogged.end());
+        pthread_mutex_unlock(&backlog_lock);
+        return fds;
+    }
+};
+
+// Forward the engine's output to the clients until the engine closes its stdout
+// Besides the engine's stdout it waits for the sockets of the clients whose
+// output backed up, so the servers whose client threads block in recv() still
+// write to a slow client without waiting for it; to_engine(lines) is called
+// with the control lines for the engine's stdin
+// Returns the result of the last read (0 once the engine closed its stdout)
+template <typename Func>
+ssize_t forward_engine_output(int engine_fd, Router &router, Func to_engine)
+{
+    PooledReader reader; // Reads up to IO_READV_BUFFERS pooled buffers per readv()
+    std::vector<struct pollfd> fds;
+    while (true)
+    {
+        fds.clear();
+        fds.push_back({engine_fd, POLLIN, 0});
+        fds.push_back({router.backlog_fd, POLLIN, 0});
+        for (int fd : router.backlogged_fds())
+        {
+            fds.push_back({fd, POLLOUT, 0});
+        }
+        if (poll(fds.data(), fds.size(), -1) == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+        if (fds[1].revents & POLLIN)
+        {
+            uint64_t count;
+            if (read(router.backlog_fd, &count, sizeof count) == -1)
+            {
+                perror("read");
+            }
+        }
+        for (size_t i = 2; i < fds.size(); i++)
+        {
+            if (fds[i].revents & (POLLOUT | POLLERR | POLLHUP))
+            {
+                std::string lines = router.on_client_writable(fds[i].fd);
+                if (!lines.empty())
+                {
+                    to_engine(lines);
+                }
+            }
+        }
+        if (fds[0].revents & (POLLIN | POLLHUP | POLLERR))
+        {
+            ssize_t nbytes = reader.read_from(engine_fd);
+            if (nbytes <= 0)
+            {
+                return nbytes;
+            }
+            // Send every complete response to the client that requested it
+            std::string lines = router.on_engine_data(reader.buffers(), reader.buffer_count());
+            if (!lines.empty())
+            {
+                to_engine(lines);
+            }
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,371 @@
+#ifndef SCC_KERNEL_H
+#define SCC_KERNEL_H
+
+#include <vector>
+#include <atomic>
+#include <limits>
+#include <utility>
+#include <type_traits>
+#include <stdint.h>
+#include "HugePages.cpp"
+using namespace std;
+
+// Kosaraju's algorithm, written once for every edge storage of Adjacency.cpp
+// (anything with cursor() and next()) and every vertex index width
+// scc_run() picks the narrowest index type that can number the vertices, so
+// the finishing order, the DFS path and the components of a small graph take
+// 2 bytes per vertex instead of 4; the adjacencies name vertices with an int,
+// so 32 bits always suffice
+// scc_run<false>() only reports the size of every SCC: the second pass then
+// collects no vertices at all
+// scc_run_region() only looks at the vertices reachable from some seeds, or at
+// the subgraph some vertices induce, and keeps its visited flags in hash sets,
+// so a query about a small part of a huge graph costs as much as that part
+
+// Progress and cancellation of a Kosaraju run on another thread
+struct SccControl
+{
+    atomic<bool> cancelled{false}; // Set to stop the run early
+    atomic<size_t> progress{0};    // Vertices done by both passes, out of 2 * vertices
+};
+
+// Summary of a Kosaraju run
+struct SccResult
+{
+    int largest = 0;    // Size of the largest SCC
+    int components = 0; // Number of SCCs
+};
+
+#define SCC_CHECK_INTERVAL 4096 // DFS steps between two looks at the SccControl
+
+// Visited flags, one bit per vertex in whole 64-bit words (the layout
+// BitMatrixAdjacency::nextUnvisited() masks rows with)
+class VisitedSet
+{
+private:
+    HugeVector<uint64_t> words;
+
+public:
+    explicit VisitedSet(size_t vertices) : words((vertices + 63) / 64, 0) {}
+
+    bool test(size_t v) const { return (words[v / 64] >> (v % 64)) & 1; }
+    void set(size_t v) { words[v / 64] |= 1ULL << (v % 64); }
+    void reset() { fill(words.begin(), words.end(), 0); }
+    const uint64_t *data() const { return words.data(); }
+};
+
+// Visited flags of a part of a graph: an open addressing hash set of vertex
+// indices, so clearing and sizing it costs as much as the part, not the graph
+class SparseVisitedSet
+{
+private:
+    vector<uint64_t> slots; // Vertex + 1, or 0 for an empty slot
+    size_t count = 0;       // Vertices in the set
+    int shift = 58;         // 64 - log2(slots.size())
+
+    size_t slot_of(size_t v) const { return (size_t)((v * 0x9E3779B97F4A7C15ULL) >> shift); }
+
+    void grow()
+    {
+        vector<uint64_t> old(slots.size() * 2, 0);
+        old.swap(slots);
+        shift--;
+        for (uint64_t key : old)
+        {
+            if (key != 0)
+            {
+                size_t i = slot_of(key - 1);
+                while (slots[i] != 0)
+                {
+                    i = (i + 1) & (slots.size() - 1);
+                }
+                slots[i] = key;
+            }
+        }
+    }
+
+public:
+    SparseVisitedSet() : slots(64, 0) {}
+
+    bool test(size_t v) const
+    {
+        for (size_t i = slot_of(v);; i = (i + 1) & (slots.size() - 1))
+        {
+            if (slots[i] == v + 1)
+            {
+                return true;
+            }
+            if (slots[i] == 0)
+            {
+                return false;
+            }
+        }
+    }
+
+    void set(size_t v)
+    {
+        if (2 * (count + 1) > slots.size())
+        {
+            grow();
+        }
+        size_t i = slot_of(v);
+        while (slots[i] != 0)
+        {
+            if (slots[i] == v + 1)
+            {
+                return;
+            }
+            i = (i + 1) & (slots.size() - 1);
+        }
+        slots[i] = v + 1;
+        count++;
+    }
+
+    size_t size() const { return count; }
+};
+
+// Filter of scc_dfs() that lets the search reach every vertex
+struct SccAllVertices
+{
+    bool operator()(size_t) const { return true; }
+};
+
+// Report progress every SCC_CHECK_INTERVAL steps; returns false once the run
+// was cancelled
+inline bool scc_checkpoint(SccControl *control, size_t &steps, size_t done)
+{
+    if (control == nullptr || (++steps % SCC_CHECK_INTERVAL) != 0)
+    {
+        return true;
+    }
+    control->progress.store(done, memory_order_relaxed);
+    return !control->cancelled.load(memory_order_relaxed);
+}
+
+// Next unvisited neighbor the filter allows of the vertex a cursor walks;
+// returns false at the end
+template <class Adjacency, class Visited, class Allowed>
+inline bool scc_next_unvisited(const Adjacency &g, typename Adjacency::Cursor &c, const Visited &visited,
+                               const Allowed &allowed, int &w)
+{
+    if constexpr (Adjacency::skips_visited && is_same<Visited, VisitedSet>::value &&
+                  is_same<Allowed, SccAllVertices>::value)
+    {
+        return g.nextUnvisited(c, visited.data(), w);
+    }
+    else
+    {
+        while (g.next(c, w))
+        {
+            if (!visited.test(w) && allowed(w))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+}
+
+// Iterative depth first search from v, so long paths cannot overflow the call
+// stack; visits the vertices in the same order as the recursive version
+// Only the vertices allowed(w) accepts are entered
+// The first pass (Postorder) appends the vertices to out by increasing
+// finishing time, the second appends them as they are discovered if Record
+// discovered counts the vertices found, base + discovered is the progress
+// Returns false if the run was cancelled
+template <bool Postorder, bool Record, class Index, class Adjacency, class Visited, class Allowed>
+bool scc_dfs(const Adjacency &g, Index v, Visited &visited, const Allowed &allowed, vector<Index> &out,
+             vector<pair<Index, typename Adjacency::Cursor>> &path, SccControl *control, size_t &steps,
+             size_t base, size_t &discovered)
+{
+    visited.set(v);
+    discovered++;
+    if constexpr (!Postorder && Record)
+    {
+        out.push_back(v);
+    }
+    path.emplace_back(v, g.cursor(v));
+    while (!path.empty())
+    {
+        if (!scc_checkpoint(control, steps, base + discovered))
+        {
+            path.clear();
+            return false;
+        }
+        int w;
+        if (!scc_next_unvisited(g, path.back().second, visited, allowed, w))
+        {
+            if constexpr (Postorder)
+            {
+                out.push_back(path.back().first);
+            }
+            path.pop_back();
+            continue;
+        }
+        visited.set(w);
+        discovered++;
+        if constexpr (!Postorder && Record)
+        {
+            out.push_back((Index)w);
+        }
+        path.emplace_back((Index)w, g.cursor(w));
+    }
+    return true;
+}
+
+// Kosaraju's algorithm with vertex indices of type Index
+// emit(component) is called with every SCC (a vector<Index>) as it is found,
+// or emit(size) with its number of vertices unless List
+// Returns false if the run was cancelled
+template <class Index, bool List, class Adjacency, class Emit>
+bool scc_kernel(const Adjacency &g, const Adjacency &rev, size_t vertices, Emit emit, SccResult &result,
+                SccControl *control)
+{
+    VisitedSet visited(vertices);
+    SccAllVertices all;
+    vector<Index> order;
+    vector<pair<Index, typename Adjacency::Cursor>> path;
+    size_t steps = 0;
+    size_t discovered = 0;
+    order.reserve(vertices);
+
+    // List the vertices according to their finishing times
+    for (size_t i = 0; i < vertices; i++)
+    {
+        if (!visited.test(i) && !scc_dfs<true, true>(g, (Index)i, visited, all, order, path, control, steps, 0, discovered))
+        {
+            return false;
+        }
+    }
+
+    // Process all vertices by decreasing finishing time on the reverse graph
+    visited.reset();
+    discovered = 0;
+    int largest = 0;
+    int components = 0;
+    vector<Index> component;
+    for (auto it = order.rbegin(); it != order.rend(); ++it)
+    {
+        if (visited.test(*it))
+        {
+            continue;
+        }
+        component.clear();
+        size_t before = discovered;
+        if (!scc_dfs<false, List>(rev, *it, visited, all, component, path, control, steps, vertices, discovered))
+        {
+            return false;
+        }
+        size_t size = discovered - before;
+        largest = max(largest, (int)size);
+        components++;
+        if constexpr (List)
+        {
+            emit(component);
+        }
+        else
+        {
+            emit(size);
+        }
+    }
+    result.largest = largest;
+    result.components = components;
+    return true;
+}
+
+// Kosaraju's algorithm with the narrowest index type for the graph's size
+// Lists the vertices of every SCC, or only its size unless List
+template <bool List = true, class Adjacency, class Emit>
+bool scc_run(const Adjacency &g, const Adjacency &rev, size_t vertices, Emit emit, SccResult &result,
+             SccControl *control = nullptr)
+{
+    if (vertices <= (size_t)numeric_limits<uint16_t>::max() + 1)
+    {
+        return scc_kernel<uint16_t, List>(g, rev, vertices, emit, result, control);
+    }
+    return scc_kernel<uint32_t, List>(g, rev, vertices, emit, result, control);
+}
+
+// Kosaraju's algorithm on a part of the graph with vertex indices of type Index
+// The first pass starts at the seeds; unless Subset it may go anywhere, so the
+// part is everything the seeds reach, otherwise it stays among the seeds, so
+// the part is the subgraph they induce. The second pass stays in the part
+// emit is called as by scc_kernel(); returns false if the run was cancelled
+template <class Index, bool List, class Adjacency, class Emit>
+bool scc_region_kernel(const Adjacency &g, const Adjacency &rev, const vector<size_t> &seeds, bool subset,
+                       Emit emit, SccResult &result, SccControl *control)
+{
+    SparseVisitedSet seed_set;
+    SparseVisitedSet part;
+    vector<Index> order;
+    vector<pair<Index, typename Adjacency::Cursor>> path;
+    size_t steps = 0;
+    size_t discovered = 0;
+    for (size_t seed : seeds)
+    {
+        seed_set.set(seed);
+    }
+    auto in_seeds = [&](size_t w)
+    { return !subset || seed_set.test(w); };
+
+    // List the vertices of the part according to their finishing times
+    for (size_t seed : seeds)
+    {
+        if (!part.test(seed) && !scc_dfs<true, true>(g, (Index)seed, part, in_seeds, order, path, control, steps, 0, discovered))
+        {
+            return false;
+        }
+    }
+
+    // Process them by decreasing finishing time on the reverse graph
+    SparseVisitedSet visited;
+    auto in_part = [&](size_t w)
+    { return part.test(w); };
+    size_t base = discovered;
+    discovered = 0;
+    int largest = 0;
+    int components = 0;
+    vector<Index> component;
+    for (auto it = order.rbegin(); it != order.rend(); ++it)
+    {
+        if (visited.test(*it))
+        {
+            continue;
+        }
+        component.clear();
+        size_t before = discovered;
+        if (!scc_dfs<false, List>(rev, *it, visited, in_part, component, path, control, steps, base, discovered))
+        {
+            return false;
+        }
+        size_t size = discovered - before;
+        largest = max(largest, (int)size);
+        components++;
+        if constexpr (List)
+        {
+            emit(component);
+        }
+        else
+        {
+            emit(size);
+        }
+    }
+    result.largest = largest;
+    result.components = components;
+    return true;
+}
+
+// Kosaraju's algorithm on the part of the graph the seeds reach (or induce,
+// if subset), with the narrowest index type for the graph's size
+template <bool List = true, class Adjacency, class Emit>
+bool scc_run_region(const Adjacency &g, const Adjacency &rev, size_t vertices, const vector<size_t> &seeds,
+                    bool subset, Emit emit, SccResult &result, SccControl *control = nullptr)
+{
+    if (vertices <= (size_t)numeric_limits<uint16_t>::max() + 1)
+    {
+        return scc_region_kernel<uint16_t, List>(g, rev, seeds, subset, emit, result, control);
+    }
+    return scc_region_kernel<uint32_t, List>(g, rev, seeds, subset, emit, result, control);
+}
+
+#endif
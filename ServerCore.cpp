@@ -0,0 +1,558 @@
+#ifndef SERVER_CORE_H
+#define SERVER_CORE_H
+
+#include <iostream>
+#include <string>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <errno.h>
+#include <poll.h>
+#include <vector>
+#include "Protocol.cpp"
+#include "Connections.cpp"
+
+// What every server shares, whatever it waits for I/O with: the listeners,
+// the engine and its pipes, the router and the batcher of the engine's
+// commands, and the handling of new connections, client input and hangups
+// The strategies of ServerStrategies.cpp only decide which thread waits for
+// which descriptor, and how the lines for the engine reach its stdin
+
+#define PORT "9034"  // Port we're listening on
+#define POOL_THREADS 4 // Worker threads of the pool strategy, unless -t says otherwise
+#define LISTEN_BACKLOG 4096 // Connections the kernel queues for accept() (capped by net.core.somaxconn)
+#define IDLE_CHECK_MAX_MS 1000 // Longest sleep of the idle connection reaper
+
+// Flags of the client sockets the event loops accept; the strategies that
+// block in recv() (a thread per connection) and io_uring (which hands EAGAIN
+// back for non blocking sockets instead of waiting) only take SOCK_CLOEXEC
+#define ACCEPT_FLAGS (SOCK_NONBLOCK | SOCK_CLOEXEC)
+
+#define WELCOME_MSG "Which action do you want to perform?\n"
+
+// How a server waits for I/O
+enum ServerStrategy
+{
+    STRATEGY_POLL,    // One thread, poll()
+    STRATEGY_SELECT,  // One thread, the select() Reactor of libraries.cpp
+    STRATEGY_EPOLL,   // One thread, epoll
+    STRATEGY_THREADS, // A thread per connection
+    STRATEGY_POOL,    // A fixed pool of threads sharing an epoll set
+    STRATEGY_URING,   // One thread, the io_uring proactor of libraries.cpp
+    STRATEGY_COUNT
+};
+
+// Names of the strategies for the -s option, in the order of ServerStrategy
+const char *const strategy_names[STRATEGY_COUNT] = {"poll", "select", "epoll", "threads", "pool", "uring"};
+
+// Command-line options of a server
+struct ServerOptions
+{
+    ServerStrategy strategy;                 // How the server waits for I/O
+    const char *metrics_port = NULL;         // Port of the plaintext metrics scrape, off by default
+    std::string engine_command = "./list -f"; // The engine, with the options passed on to it
+    int pool_threads = POOL_THREADS;         // Worker threads of the pool strategy
+    int backlog = LISTEN_BACKLOG;            // Backlog of the listeners
+    int listeners = 1;                       // Listeners sharing the port with SO_REUSEPORT
+    int idle_seconds = 0;                    // Idle timeout of the clients, 0 for none
+    bool zerocopy = false;                   // Send the clients' large writes with MSG_ZEROCOPY
+    std::vector<int> io_cpus;                // CPUs the server's threads run on, empty for any
+};
+
+// State shared by every strategy
+struct ServerContext
+{
+    std::vector<int> listeners; // Listening sockets of the clients, all bound to PORT
+    int metrics_listener = -1; // Listening socket of the metrics scrape, -1 if off
+    int command_stdin_fd = -1; // The engine's stdin
+    int command_stdout_fd = -1; // The engine's stdout
+    Router router;             // Routes responses back to the requesting clients
+    ConnectionTable connections; // Client connections and their idle timers
+    EngineWriter *engine_writer = nullptr; // Batches the commands of all clients into the engine's stdin
+
+    // True if fd is one of the client listeners
+    bool is_listener(int fd) const
+    {
+        for (int listener : listeners)
+        {
+            if (listener == fd)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+ServerContext server; // The server of this process
+
+// Get sockaddr, IPv4 or IPv6:
+void *get_in_addr(struct sockaddr *sa)
+{
+    if (sa->sa_family == AF_INET)
+    {
+        return &(((struct sockaddr_in *)sa)->sin_addr);
+    }
+
+    return &(((struct sockaddr_in6 *)sa)->sin6_addr);
+}
+
+// Return a non blocking socket listening on the given port
+// With reuseport, several sockets can listen on the same port and the kernel
+// spreads the incoming connections over them
+int get_listener_socket(const char *port, int backlog, bool reuseport)
+{
+    int listener; // Listening socket descriptor
+    int yes = 1;  // For setsockopt() SO_REUSEADDR, below
+    int rv;
+
+    struct addrinfo hints, *ai, *p;
+
+    // Get us a socket and bind it
+    memset(&hints, 0, sizeof hints);
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    if ((rv = getaddrinfo(NULL, port, &hints, &ai)) != 0)
+    {
+        fprintf(stderr, "server: %s\n", gai_strerror(rv));
+        exit(1);
+    }
+
+    for (p = ai; p != NULL; p = p->ai_next)
+    {
+        listener = socket(p->ai_family, p->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, p->ai_protocol);
+        if (listener < 0)
+        {
+            continue;
+        }
+
+        // Lose the pesky "address already in use" error message
+        setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(int));
+        if (reuseport)
+        {
+            setsockopt(listener, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(int));
+        }
+
+        if (bind(listener, p->ai_addr, p->ai_addrlen) < 0)
+        {
+            close(listener);
+            continue;
+        }
+
+        break;
+    }
+
+    freeaddrinfo(ai); // All done with this
+
+    // If we got here, it means we didn't get bound
+    if (p == NULL)
+    {
+        return -1;
+    }
+
+    // Listen
+    if (listen(listener, backlog) == -1)
+    {
+        return -1;
+    }
+
+    return listener;
+}
+
+// Function to run a command and get its stdin and stdout file descriptors
+void run_command_and_get_pipes(const char *command, int *stdin_fd, int *stdout_fd)
+{
+    int stdin_pipe[2], stdout_pipe[2];
+    if (pipe(stdin_pipe) == -1 || pipe(stdout_pipe) == -1)
+    {
+        perror("pipe");
+        exit(1);
+    }
+    pid_t pid = fork();
+    if (pid == -1)
+    {
+        perror("fork");
+        exit(1);
+    }
+    else if (pid == 0)
+    {
+        // Child process
+        close(stdin_pipe[1]);              // Close the write end of the stdin pipe
+        dup2(stdin_pipe[0], STDIN_FILENO); // Redirect stdin to the read end of the pipe
+        close(stdin_pipe[0]);
+
+        close(stdout_pipe[0]);               // Close the read end of the stdout pipe
+        dup2(stdout_pipe[1], STDOUT_FILENO); // Redirect stdout to the write end of the pipe
+        close(stdout_pipe[1]);
+
+        execlp("bash", "bash", "-c", command, (char *)NULL);
+        perror("execlp");
+        exit(1);
+    }
+    else // Parent process
+    {
+        close(stdin_pipe[0]);  // Close the read end of the stdin pipe
+        close(stdout_pipe[1]); // Close the write end of the stdout pipe
+
+        *stdin_fd = stdin_pipe[1];   // Write end of the stdin pipe
+        *stdout_fd = stdout_pipe[0]; // Read end of the stdout pipe
+    }
+}
+
+// Parse the command-line options; default_strategy is used unless -s names another
+ServerOptions parse_server_options(int argc, char *argv[], ServerStrategy default_strategy)
+{
+    ServerOptions options;
+    options.strategy = default_strategy;
+    int opt;
+    int node;
+    while ((opt = getopt(argc, argv, "s:t:b:l:i:a:m:zw:c:n:C:H:")) != -1)
+    {
+        if (opt == 's')
+        {
+            int s = 0;
+            while (s < STRATEGY_COUNT && strcmp(optarg, strategy_names[s]) != 0)
+            {
+                s++;
+            }
+            if (s == STRATEGY_COUNT)
+            {
+                fprintf(stderr, "unknown strategy %s (poll, select, epoll, threads, pool or uring)\n", optarg);
+                exit(1);
+            }
+            options.strategy = (ServerStrategy)s;
+        }
+        else if (opt == 't' && atoi(optarg) > 0)
+        {
+            options.pool_threads = atoi(optarg);
+        }
+        else if (opt == 'b' && atoi(optarg) > 0)
+        {
+            options.backlog = atoi(optarg);
+        }
+        else if (opt == 'l' && atoi(optarg) > 0)
+        {
+            options.listeners = atoi(optarg);
+        }
+        else if (opt == 'i' && atoi(optarg) >= 0)
+        {
+            options.idle_seconds = atoi(optarg);
+        }
+        else if (opt == 'a' && !parse_cpu_list(optarg).empty())
+        {
+            options.io_cpus = parse_cpu_list(optarg);
+        }
+        else if (opt == 'm')
+        {
+            options.metrics_port = optarg;
+        }
+        else if (opt == 'z')
+        {
+            options.zerocopy = true;
+        }
+        else if ((opt == 'n' && !parse_numa_node(optarg, node)) || (opt == 'C' && parse_cpu_list(optarg).empty()))
+        {
+            // Refused here rather than by the engine once it was forked
+            fprintf(stderr, "bad %s %s\n", opt == 'n' ? "NUMA node" : "CPU list", optarg);
+            exit(1);
+        }
+        else if (opt == 'w' || opt == 'c' || opt == 'n' || opt == 'C' || opt == 'H')
+        {
+            // Write-ahead log file, commit interval, NUMA node, job CPUs and huge pages of the engine
+            options.engine_command += std::string(" -") + (char)opt + " '" + optarg + "'";
+        }
+        else
+        {
+            fprintf(stderr, "usage: %s [-s poll|select|epoll|threads|pool|uring] [-t pool_threads] "
+                            "[-b backlog] [-l listeners] [-i idle_seconds] [-a io_cpus] [-m metrics_port] [-z] [-w wal_file] "
+                            "[-c commit_interval_ms] [-n engine_numa_node] [-C engine_job_cpus] [-H off|thp|explicit]\n",
+                    argv[0]);
+            exit(1);
+        }
+    }
+    if (options.zerocopy && options.strategy == STRATEGY_URING)
+    {
+        // The ring waits for the sockets inside the kernel, where the POLLERR
+        // of the zerocopy completions would wake its receives again and again
+        fprintf(stderr, "-z is not supported by the uring strategy\n");
+        exit(1);
+    }
+    return options;
+}
+
+// Function to report when at least 50% of the graph joins or leaves the same SCC
+// It sleeps on the router's SCC event channel and only wakes up when the
+// engine published a new SCC summary after a K
+void *check_scc_condition(void *arg)
+{
+    EventChannel<SccEvent, 64>::Subscription *events = static_cast<EventChannel<SccEvent, 64>::Subscription *>(arg);
+    SccEvent event;
+    while (true)
+    {
+        events->wait(event);
+        if (!event.majority_changed)
+        {
+            continue;
+        }
+        if (event.majority)
+        {
+            std::cout << "At Least 50% of the graph belongs to the same SCC\n";
+        }
+        else
+        {
+            std::cout << "At Least 50% of the graph no longer belongs to the same SCC\n";
+        }
+        std::cout << std::flush;
+    }
+    return NULL;
+}
+
+// Close the connections that sent nothing for the idle timeout
+// A connection that still waits for answers is kept. The socket is only shut
+// down: the strategy that owns it sees the hangup and closes it the usual way
+// Returns the time in ms until the next check is due
+uint64_t reap_idle_connections_once()
+{
+    uint64_t wait_ms = server.connections.expire([](int fd)
+                                                 {
+                                                     if (server.router.is_busy(fd))
+                                                     {
+                                                         return false;
+                                                     }
+                                                     printf("server: socket %d idle, closing it\n", fd);
+                                                     server_metrics().connections_timed_out.add();
+                                                     shutdown(fd, SHUT_RDWR);
+                                                     return true;
+                                                 });
+    return std::min<uint64_t>(wait_ms, IDLE_CHECK_MAX_MS);
+}
+
+// Function of the thread closing the idle connections, for the strategies
+// that have no timers of their own
+void *reap_idle_connections(void *)
+{
+    while (true)
+    {
+        usleep(reap_idle_connections_once() * 1000);
+    }
+    return NULL;
+}
+
+// Open the listeners and start the engine
+void start_server(const ServerOptions &options)
+{
+    // A client that hangs up during a write must not kill the server
+    signal(SIGPIPE, SIG_IGN);
+    server.router.zerocopy = options.zerocopy;
+
+    // Several listeners only share the port with SO_REUSEPORT
+    for (int i = 0; i < options.listeners; i++)
+    {
+        int listener = get_listener_socket(PORT, options.backlog, options.listeners > 1);
+        if (listener == -1)
+        {
+            fprintf(stderr, "error getting listening socket\n");
+            exit(1);
+        }
+        server.listeners.push_back(listener);
+    }
+
+    // Serve the metrics scrape port if it was asked for
+    if (options.metrics_port != NULL)
+    {
+        server.metrics_listener = get_listener_socket(options.metrics_port, options.backlog, false);
+        if (server.metrics_listener == -1)
+        {
+            fprintf(stderr, "error getting metrics listening socket\n");
+            exit(1);
+        }
+    }
+
+    // Run the command and get its stdin and stdout file descriptors
+    run_command_and_get_pipes(options.engine_command.c_str(), &server.command_stdin_fd, &server.command_stdout_fd);
+    enlarge_pipe(server.command_stdin_fd);
+    enlarge_pipe(server.command_stdout_fd);
+    server.engine_writer = new EngineWriter(server.command_stdin_fd);
+
+    // Keep the server's threads, all started from here on, off the engine's
+    // CPUs; the engine was forked before, so it keeps its own placement
+    if (!options.io_cpus.empty())
+    {
+        pin_thread(pthread_self(), options.io_cpus);
+    }
+
+    // Subscribe to the SCC events before the first response can arrive
+    pthread_t scc_thread;
+    pthread_create(&scc_thread, NULL, check_scc_condition,
+                   new EventChannel<SccEvent, 64>::Subscription(server.router.scc_events.subscribe()));
+    pthread_detach(scc_thread);
+
+    if (options.idle_seconds > 0)
+    {
+        server.connections.set_idle_timeout(options.idle_seconds * 1000ULL);
+        // The select() Reactor runs the checks on its own timers
+        if (options.strategy != STRATEGY_SELECT)
+        {
+            pthread_t reaper_thread;
+            pthread_create(&reaper_thread, NULL, reap_idle_connections, NULL);
+            pthread_detach(reaper_thread);
+        }
+    }
+}
+
+// Make the engine's stdin non blocking, for the strategies that queue the
+// engine's commands and write them from their event loop with flush()
+void make_engine_input_nonblocking()
+{
+    fcntl(server.command_stdin_fd, F_SETFL, fcntl(server.command_stdin_fd, F_GETFL) | O_NONBLOCK);
+}
+
+// Greet a newly accepted client and register it with the router
+// Returns false if it could not be greeted (it is closed then)
+bool add_client(int fd)
+{
+    struct sockaddr_storage remoteaddr; // Client address
+    socklen_t addrlen = sizeof remoteaddr;
+    char remoteIP[INET6_ADDRSTRLEN] = "?";
+    if (getpeername(fd, (struct sockaddr *)&remoteaddr, &addrlen) == 0)
+    {
+        inet_ntop(remoteaddr.ss_family, get_in_addr((struct sockaddr *)&remoteaddr), remoteIP, INET6_ADDRSTRLEN);
+    }
+    printf("server: new connection from %s on socket %d\n", remoteIP, fd);
+
+    // Send welcome message to the new client
+    if (send(fd, WELCOME_MSG, strlen(WELCOME_MSG), MSG_NOSIGNAL) == -1)
+    {
+        perror("send");
+        close(fd);
+        return false;
+    }
+    server.router.add_client(fd);
+    server.connections.add(fd);
+    return true;
+}
+
+// Accept every connection waiting on a (non blocking) listener, with accept4()
+// so the flags of the socket cost no extra system call, and call
+// on_client(fd) for each that was registered
+// Draining the queue on every wakeup keeps it short during a connection storm
+template <typename Func>
+void accept_clients(int listener, int flags, Func on_client)
+{
+    while (true)
+    {
+        int newfd = accept4(listener, NULL, NULL, flags);
+        if (newfd == -1)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+            {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                perror("accept"); // Out of descriptors: the rest wait in the backlog
+            }
+            return;
+        }
+        if (add_client(newfd))
+        {
+            on_client(newfd);
+        }
+    }
+}
+
+// Accept every connection waiting on the metrics scrape port
+// A scrape is answered like a Stats command, then closed by the router
+// Returns the command lines for the engine's stdin
+std::string accept_scrape_clients(int metrics_listener)
+{
+    std::string to_engine;
+    while (true)
+    {
+        int newfd = accept4(metrics_listener, NULL, NULL, ACCEPT_FLAGS);
+        if (newfd == -1)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+            {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                perror("accept");
+            }
+            return to_engine;
+        }
+        to_engine += server.router.add_scrape_client(newfd);
+    }
+}
+
+// Block until a descriptor is readable, for the threads that wait on a
+// single (non blocking) listener
+void wait_readable(int fd)
+{
+    struct pollfd pfd = {fd, POLLIN, 0};
+    while (poll(&pfd, 1, -1) == -1 && errno == EINTR)
+    {
+    }
+}
+
+// Forget a client and close its socket
+// The router and the table forget the socket before it is closed, so the
+// number is never used after another connection got it
+// Returns the control line that cancels the client's jobs, for the engine's stdin
+std::string close_client(int fd)
+{
+    std::string closed = server.router.remove_client(fd);
+    server.connections.remove(fd);
+    close(fd);
+    return closed;
+}
+
+// Handle the result of a recv() of nbytes from a client
+// Appends the tagged command lines (or, once the client hung up, the control
+// line that cancels its jobs) to to_engine
+// Returns false if the client is gone; its socket is closed then
+bool on_client_input(int fd, const char *data, ssize_t nbytes, std::string &to_engine)
+{
+    if (nbytes > 0)
+    {
+        server.connections.touch(fd);
+        to_engine += server.router.on_client_data(fd, data, nbytes);
+        return true;
+    }
+    if (nbytes == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+    {
+        // Nothing to read after all: the wakeup may have been the completions
+        // of zerocopy sends
+        server.router.on_client_idle_wakeup(fd);
+        return true;
+    }
+    if (nbytes == 0)
+    {
+        printf("server: socket %d hung up\n", fd);
+    }
+    else
+    {
+        perror("recv");
+    }
+    to_engine += close_client(fd);
+    return false;
+}
+
+// Read from a client into buf; see on_client_input()
+bool read_client(int fd, IOBuffer *buf, std::string &to_engine)
+{
+    ssize_t nbytes = recv(fd, buf->data, IO_BUFFER_SIZE, 0);
+    return on_client_input(fd, buf->data, nbytes, to_engine);
+}
+
+#endif
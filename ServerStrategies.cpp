@@ -0,0 +1,1057 @@
+#ifndef SERVER_STRATEGIES_H
+#define SERVER_STRATEGIES_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <algorithm>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include "libraries.cpp"
+#include "ServerCore.cpp"
+
+// The ways a server can wait for I/O, all on the state of ServerCore.cpp
+// The single threaded strategies queue the engine's commands of a whole round
+// and write them with one flush() once the engine's stdin is writable; the
+// threaded ones write them from the thread that got them with submit()
+
+#define EPOLL_EVENTS 64    // Events taken by one epoll_wait()
+#define URING_ENTRIES 256  // Submission queue size of the io_uring strategy
+
+// ---------------------------------------------------------------- poll()
+
+// Add a new file descriptor to the set
+void add_to_pfds(struct pollfd *pfds[], int newfd, int *fd_count, int *fd_size)
+{
+    // If we don't have room, add more space in the pfds array
+    if (*fd_count == *fd_size)
+    {
+        *fd_size *= 2; // Double it
+
+        *pfds = (struct pollfd *)realloc(*pfds, sizeof(**pfds) * (*fd_size));
+    }
+
+    (*pfds)[*fd_count].fd = newfd;
+    (*pfds)[*fd_count].events = POLLIN; // Check ready-to-read
+    (*pfds)[*fd_count].revents = 0;     // Added during a scan: nothing to report yet
+
+    (*fd_count)++;
+}
+
+// Remove an index from the set
+// The last entry moves into slot i, so a scan must look at slot i again
+void del_from_pfds(struct pollfd pfds[], int i, int *fd_count)
+{
+    // Copy the one from the end over this one
+    pfds[i] = pfds[*fd_count - 1];
+
+    (*fd_count)--;
+}
+
+// One thread waiting in poll() for every descriptor
+void serve_poll()
+{
+    make_engine_input_nonblocking();
+    PooledReader engine_reader; // Reads the command's stdout into pooled buffers
+
+    // Start off with room for 5 connections
+    // (We'll realloc as necessary)
+    int fd_count = 0;
+    int fd_size = 5;
+    struct pollfd *pfds = (struct pollfd *)malloc(sizeof *pfds * fd_size);
+
+    for (int listener : server.listeners)
+    {
+        add_to_pfds(&pfds, listener, &fd_count, &fd_size);
+    }
+    add_to_pfds(&pfds, server.command_stdout_fd, &fd_count, &fd_size);
+    // The stdin pipe is polled for writing only while commands are pending
+    add_to_pfds(&pfds, server.command_stdin_fd, &fd_count, &fd_size);
+    pfds[fd_count - 1].events = 0;
+    if (server.metrics_listener != -1)
+    {
+        add_to_pfds(&pfds, server.metrics_listener, &fd_count, &fd_size);
+    }
+
+    // Main loop
+    for (;;)
+    {
+        if (poll(pfds, fd_count, -1) == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            perror("poll");
+            exit(1);
+        }
+
+        std::string to_engine; // Lines for the engine's stdin gathered in this round
+        for (int i = 0; i < fd_count; i++)
+        {
+            int fd = pfds[i].fd;
+            if (fd == server.command_stdin_fd)
+            {
+                continue; // Written once the round is done
+            }
+
+            // Write more of a slow client's output once its socket takes it
+            if (pfds[i].revents & POLLOUT)
+            {
+                to_engine += server.router.on_client_writable(fd);
+            }
+
+            if (!(pfds[i].revents & (POLLIN | POLLHUP | POLLERR)))
+            {
+                continue;
+            }
+            if (server.is_listener(fd))
+            {
+                accept_clients(fd, ACCEPT_FLAGS, [&](int newfd)
+                               { add_to_pfds(&pfds, newfd, &fd_count, &fd_size); });
+            }
+            else if (fd == server.metrics_listener)
+            {
+                to_engine += accept_scrape_clients(fd);
+            }
+            else if (fd == server.command_stdout_fd)
+            {
+                ssize_t nbytes = engine_reader.read_from(fd);
+                if (nbytes <= 0)
+                {
+                    if (nbytes == 0)
+                    {
+                        printf("server: command stdout closed\n");
+                    }
+                    else
+                    {
+                        perror("read");
+                    }
+                    close(fd); // Bye!
+                    del_from_pfds(pfds, i, &fd_count);
+                    i--;
+                }
+                else
+                {
+                    // Send every complete response to the client that requested it
+                    to_engine += server.router.on_engine_data(engine_reader.buffers(), engine_reader.buffer_count());
+                }
+            }
+            else
+            {
+                // A regular client
+                IOBuffer *buf = BufferPool::instance().acquire();
+                if (!read_client(fd, buf, to_engine))
+                {
+                    del_from_pfds(pfds, i, &fd_count);
+                    i--;
+                }
+                BufferPool::instance().unref(buf);
+            }
+        }
+
+        // The commands of every client read in this round go to the engine in one write
+        if (!to_engine.empty())
+        {
+            server.engine_writer->queue(to_engine);
+        }
+        bool engine_idle = server.engine_writer->flush();
+
+        // Wait for a socket to be writable only while its output is backed up
+        for (int i = 0; i < fd_count; i++)
+        {
+            int fd = pfds[i].fd;
+            if (fd == server.command_stdin_fd)
+            {
+                pfds[i].events = engine_idle ? 0 : POLLOUT;
+            }
+            else if (!server.is_listener(fd) && fd != server.metrics_listener && fd != server.command_stdout_fd)
+            {
+                pfds[i].events = POLLIN | (server.router.has_backlog(fd) ? POLLOUT : 0);
+            }
+        }
+    }
+}
+
+// ---------------------------------------------------------------- select() Reactor
+
+// Class for writing batches of commands to the command's stdin
+// It is registered for write events only while commands are pending, so the
+// commands of every client read in one reactor round leave with one write
+class EngineInputHandler : public EventHandler
+{
+private:
+    Reactor *reactor; // Pointer to the reactor
+
+public:
+    EngineInputHandler(Reactor *reactor) : reactor(reactor) {}
+
+    // Queue commands and wait for the command's stdin to become writable
+    void submit(const std::string &commands)
+    {
+        if (!commands.empty())
+        {
+            server.engine_writer->queue(commands);
+            reactor->addFdToReactor(server.command_stdin_fd, this, false);
+        }
+    }
+
+    // Handle the command's stdin becoming writable
+    void handle_event() override
+    {
+        if (server.engine_writer->flush())
+        {
+            reactor->removeFdFromReactor(server.command_stdin_fd);
+        }
+    }
+};
+
+// Class for writing the rest of a slow client's output once its socket is writable
+// It is registered for write events only while the client's output is backed up
+class ClientWriteHandler : public EventHandler
+{
+private:
+    int client_fd;                    // File descriptor for the client
+    EngineInputHandler *engine_input; // Pointer to the command's stdin handler
+    Reactor *reactor;                 // Pointer to the reactor
+
+public:
+    ClientWriteHandler(int fd, EngineInputHandler *engine_input, Reactor *reactor)
+        : client_fd(fd), engine_input(engine_input), reactor(reactor) {}
+
+    // Handle the client's socket becoming writable
+    void handle_event() override
+    {
+        engine_input->submit(server.router.on_client_writable(client_fd));
+        if (!server.router.has_backlog(client_fd))
+        {
+            reactor->removeFdFromReactor(client_fd, false);
+        }
+    }
+};
+
+// Class for handling command output and routing it to the clients
+class CommandHandler : public EventHandler
+{
+private:
+    PooledReader reader;              // Reads the command's stdout into pooled buffers
+    Reactor *reactor;                 // Pointer to the reactor
+    EngineInputHandler *engine_input; // Pointer to the command's stdin handler
+    std::map<int, ClientWriteHandler *> writers; // Write handler of every client socket that backed up
+    std::vector<int> watched;                    // Sockets registered for write events
+
+public:
+    CommandHandler(Reactor *reactor, EngineInputHandler *engine_input)
+        : reactor(reactor), engine_input(engine_input) {}
+
+    // Watch exactly the client sockets whose output is backed up for write events
+    void watch_backlogs()
+    {
+        for (int fd : watched)
+        {
+            reactor->removeFdFromReactor(fd, false);
+        }
+        watched = server.router.backlogged_fds();
+        for (int fd : watched)
+        {
+            ClientWriteHandler *&writer = writers[fd];
+            if (writer == nullptr)
+            {
+                writer = new ClientWriteHandler(fd, engine_input, reactor);
+            }
+            reactor->addFdToReactor(fd, writer, false);
+        }
+    }
+
+    // Handle events from the command's stdout
+    void handle_event() override
+    {
+        int stdout_fd = server.command_stdout_fd;
+        ssize_t nbytes = reader.read_from(stdout_fd);
+        if (nbytes <= 0)
+        {
+            if (nbytes == 0)
+            {
+                printf("server: command stdout closed\n");
+            }
+            else
+            {
+                perror("read");
+            }
+            close(stdout_fd);
+            reactor->removeFdFromReactor(stdout_fd);
+        }
+        else
+        {
+            engine_input->submit(server.router.on_engine_data(reader.buffers(), reader.buffer_count()));
+            watch_backlogs();
+        }
+    }
+};
+
+// Class for handling client input and sending it to the command's stdin
+class ClientHandler : public EventHandler
+{
+private:
+    int client_fd;                    // File descriptor for the client
+    EngineInputHandler *engine_input; // Pointer to the command's stdin handler
+    Reactor *reactor;                 // Pointer to the reactor
+    CommandHandler *cmd_handler;      // Pointer to the command handler
+
+public:
+    ClientHandler(int fd, EngineInputHandler *engine_input, Reactor *reactor, CommandHandler *cmd_handler)
+        : client_fd(fd), engine_input(engine_input), reactor(reactor), cmd_handler(cmd_handler) {}
+
+    // Handle events from the client
+    void handle_event() override
+    {
+        IOBuffer *buf = BufferPool::instance().acquire();
+        std::string to_engine;
+        if (!read_client(client_fd, buf, to_engine))
+        {
+            reactor->removeFdFromReactor(client_fd);
+            cmd_handler->watch_backlogs();
+        }
+        engine_input->submit(to_engine);
+        BufferPool::instance().unref(buf);
+    }
+};
+
+// Class for handling new incoming client connections
+class ListenerHandler : public EventHandler
+{
+private:
+    int listener_fd;                  // File descriptor for the listener socket
+    Reactor *reactor;                 // Pointer to the reactor
+    CommandHandler *cmd_handler;      // Pointer to the command handler
+    EngineInputHandler *engine_input; // Pointer to the command's stdin handler
+    std::map<int, ClientHandler *> *client_handlers; // Handler of every socket number, reused by its next connection
+
+public:
+    ListenerHandler(int fd, Reactor *reactor, CommandHandler *cmd_handler, EngineInputHandler *engine_input,
+                    std::map<int, ClientHandler *> *client_handlers)
+        : listener_fd(fd), reactor(reactor), cmd_handler(cmd_handler), engine_input(engine_input),
+          client_handlers(client_handlers) {}
+
+    // Handle events from the listener socket
+    void handle_event() override
+    {
+        accept_clients(listener_fd, ACCEPT_FLAGS, [&](int newfd)
+                       {
+                           ClientHandler *&handler = (*client_handlers)[newfd];
+                           if (handler == nullptr)
+                           {
+                               handler = new ClientHandler(newfd, engine_input, reactor, cmd_handler);
+                           }
+                           reactor->addFdToReactor(newfd, handler, true);
+                       });
+    }
+};
+
+// Class for answering connections to the metrics scrape port
+class MetricsListenerHandler : public EventHandler
+{
+private:
+    EngineInputHandler *engine_input; // Pointer to the command's stdin handler
+
+public:
+    MetricsListenerHandler(EngineInputHandler *engine_input) : engine_input(engine_input) {}
+
+    // Handle events from the metrics listener socket
+    void handle_event() override
+    {
+        engine_input->submit(accept_scrape_clients(server.metrics_listener));
+    }
+};
+
+// Close the idle clients from the reactor's loop, then check again when the
+// next idle timer is due
+void schedule_idle_check(Reactor *reactor, uint64_t delay_ms)
+{
+    reactor->scheduleAfter(delay_ms, [reactor]()
+                           { schedule_idle_check(reactor, reap_idle_connections_once()); });
+}
+
+// One thread running the select() Reactor of libraries.cpp
+void serve_select()
+{
+    make_engine_input_nonblocking();
+    Reactor reactor;
+    EngineInputHandler *engine_input = new EngineInputHandler(&reactor);
+    CommandHandler *cmd_handler = new CommandHandler(&reactor, engine_input);
+    reactor.addFdToReactor(server.command_stdout_fd, cmd_handler, true);
+    // A client's handler only knows its socket, so the handler of a socket number
+    // serves every connection that gets that number: their count never grows
+    // past the largest number of sockets open at once
+    std::map<int, ClientHandler *> client_handlers;
+    for (int listener : server.listeners)
+    {
+        reactor.addFdToReactor(listener, new ListenerHandler(listener, &reactor, cmd_handler, engine_input, &client_handlers), true);
+    }
+    if (server.metrics_listener != -1)
+    {
+        reactor.addFdToReactor(server.metrics_listener, new MetricsListenerHandler(engine_input), true);
+    }
+    if (server.connections.idle_timeout() > 0)
+    {
+        schedule_idle_check(&reactor, 0);
+    }
+    reactor.startReactor();
+}
+
+// ---------------------------------------------------------------- epoll
+
+// Change the events epoll waits for on a descriptor
+void epoll_watch(int epoll_fd, int fd, uint32_t events)
+{
+    struct epoll_event ev;
+    ev.events = events;
+    ev.data.fd = fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &ev) == -1 && errno == ENOENT)
+    {
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+    }
+}
+
+// One thread waiting in epoll_wait()
+// Unlike poll() the interest set lives in the kernel, so a round costs as much
+// as the descriptors that are ready, not as all the connections; only the
+// sockets whose backlog started or ended are changed after a round
+void serve_epoll()
+{
+    make_engine_input_nonblocking();
+    PooledReader engine_reader;
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd == -1)
+    {
+        perror("epoll_create1");
+        exit(1);
+    }
+    for (int listener : server.listeners)
+    {
+        epoll_watch(epoll_fd, listener, EPOLLIN);
+    }
+    epoll_watch(epoll_fd, server.command_stdout_fd, EPOLLIN);
+    epoll_watch(epoll_fd, server.command_stdin_fd, 0); // EPOLLOUT only while commands are pending
+    if (server.metrics_listener != -1)
+    {
+        epoll_watch(epoll_fd, server.metrics_listener, EPOLLIN);
+    }
+
+    struct epoll_event events[EPOLL_EVENTS];
+    std::set<int> clients;    // Sockets of the clients
+    std::vector<int> watched; // Client sockets watched for EPOLLOUT, sorted
+    bool engine_watched = false;
+    for (;;)
+    {
+        int n = epoll_wait(epoll_fd, events, EPOLL_EVENTS, -1);
+        if (n == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            perror("epoll_wait");
+            exit(1);
+        }
+
+        std::string to_engine; // Lines for the engine's stdin gathered in this round
+        for (int i = 0; i < n; i++)
+        {
+            int fd = events[i].data.fd;
+            uint32_t ready = events[i].events;
+            if (fd == server.command_stdin_fd)
+            {
+                continue; // Written once the round is done
+            }
+            if (server.is_listener(fd))
+            {
+                accept_clients(fd, ACCEPT_FLAGS, [&](int newfd)
+                               {
+                                   clients.insert(newfd);
+                                   epoll_watch(epoll_fd, newfd, EPOLLIN);
+                               });
+            }
+            else if (fd == server.metrics_listener)
+            {
+                to_engine += accept_scrape_clients(fd);
+            }
+            else if (fd == server.command_stdout_fd)
+            {
+                ssize_t nbytes = engine_reader.read_from(fd);
+                if (nbytes <= 0)
+                {
+                    if (nbytes == 0)
+                    {
+                        printf("server: command stdout closed\n");
+                    }
+                    else
+                    {
+                        perror("read");
+                    }
+                    close(fd); // Also leaves the epoll set
+                }
+                else
+                {
+                    to_engine += server.router.on_engine_data(engine_reader.buffers(), engine_reader.buffer_count());
+                }
+            }
+            else if (clients.count(fd))
+            {
+                if (ready & EPOLLOUT)
+                {
+                    to_engine += server.router.on_client_writable(fd);
+                }
+                if (ready & (EPOLLIN | EPOLLHUP | EPOLLERR))
+                {
+                    IOBuffer *buf = BufferPool::instance().acquire();
+                    if (!read_client(fd, buf, to_engine))
+                    {
+                        clients.erase(fd); // Closing it also left the epoll set
+                    }
+                    BufferPool::instance().unref(buf);
+                }
+            }
+        }
+
+        if (!to_engine.empty())
+        {
+            server.engine_writer->queue(to_engine);
+        }
+        bool engine_idle = server.engine_writer->flush();
+        if (engine_idle == engine_watched)
+        {
+            engine_watched = !engine_idle;
+            epoll_watch(epoll_fd, server.command_stdin_fd, engine_watched ? (uint32_t)EPOLLOUT : 0);
+        }
+
+        // Change the events of the sockets whose backlog started or ended
+        std::vector<int> backlogged = server.router.backlogged_fds();
+        sort(backlogged.begin(), backlogged.end());
+        std::vector<int> changed;
+        set_symmetric_difference(watched.begin(), watched.end(), backlogged.begin(), backlogged.end(),
+                                 back_inserter(changed));
+        for (int fd : changed)
+        {
+            if (clients.count(fd))
+            {
+                bool backlog = binary_search(backlogged.begin(), backlogged.end(), fd);
+                epoll_watch(epoll_fd, fd, EPOLLIN | (backlog ? (uint32_t)EPOLLOUT : 0));
+            }
+        }
+        watched.swap(backlogged);
+    }
+}
+
+// ---------------------------------------------------------------- threads
+
+// Function to read from the command's stdout and send to clients
+// Clients whose sockets are full get the rest of their output once they are
+// writable, so a slow client never holds up the others; the control lines it
+// sends back are only handed to the writer thread, since waiting for the
+// engine to read them while the engine waits for this thread to read its
+// output would never end
+void *read_command_output(void *)
+{
+    ssize_t nbytes = forward_engine_output(server.command_stdout_fd, server.router, [](const std::string &lines)
+                                           { server.engine_writer->submit(lines); });
+
+    if (nbytes == 0)
+    {
+        printf("server: command stdout closed\n");
+    }
+    else
+    {
+        perror("read");
+    }
+
+    close(server.command_stdout_fd);
+    return NULL;
+}
+
+// Function to answer connections to the metrics scrape port
+void *metrics_function(void *)
+{
+    while (true)
+    {
+        wait_readable(server.metrics_listener);
+        server.engine_writer->submit(accept_scrape_clients(server.metrics_listener));
+    }
+    return NULL;
+}
+
+// Start the threads every threaded strategy has: the one writing the engine's
+// stdin, the one forwarding the engine's output and the one answering the
+// metrics scrapes
+void start_service_threads()
+{
+    server.engine_writer->start();
+    pthread_t command_thread;
+    pthread_create(&command_thread, NULL, read_command_output, NULL);
+    pthread_detach(command_thread);
+    if (server.metrics_listener != -1)
+    {
+        pthread_t metrics_thread;
+        pthread_create(&metrics_thread, NULL, metrics_function, NULL);
+        pthread_detach(metrics_thread);
+    }
+}
+
+// Function to handle client connections
+void *handle_client(void *client_socket)
+{
+    int client_fd = *((int *)client_socket);
+    IOBuffer *buf = BufferPool::instance().acquire(); // Pooled buffer, reused by the next connection
+
+    // Continuously receive data from the client and write it to the command's stdin
+    std::string to_engine;
+    bool open = true;
+    while (open)
+    {
+        open = read_client(client_fd, buf, to_engine);
+        server.engine_writer->submit_throttled(to_engine);
+        to_engine.clear();
+    }
+    BufferPool::instance().unref(buf);
+    return NULL;
+}
+
+Proactor client_threads; // Runs a thread for every client of the threads strategy
+
+// Function to accept the connections of one listener and create threads to handle them
+void *accept_function(void *arg)
+{
+    int listener = (int)(intptr_t)arg;
+    while (true)
+    {
+        wait_readable(listener);
+        accept_clients(listener, SOCK_CLOEXEC, [](int newfd)
+                       {
+                           if (client_threads.startProactor(newfd, handle_client) == (pthread_t)-1)
+                           {
+                               close_client(newfd);
+                           }
+                       });
+    }
+    return NULL;
+}
+
+// A thread per connection, blocked in recv(), and an accepting thread per listener
+void serve_threads()
+{
+    start_service_threads();
+    std::vector<pthread_t> acceptors(server.listeners.size());
+    for (size_t i = 0; i < acceptors.size(); i++)
+    {
+        pthread_create(&acceptors[i], NULL, accept_function, (void *)(intptr_t)server.listeners[i]);
+    }
+    for (pthread_t &acceptor : acceptors)
+    {
+        pthread_join(acceptor, NULL);
+    }
+}
+
+// ---------------------------------------------------------------- thread pool
+
+// Wait for a descriptor's next input in the pool's epoll set
+// EPOLLONESHOT hands every event to a single worker, and the descriptor is
+// not reported again until that worker re-arms it
+void pool_arm(int epoll_fd, int fd, int op)
+{
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLONESHOT;
+    ev.data.fd = fd;
+    if (epoll_ctl(epoll_fd, op, fd, &ev) == -1)
+    {
+        perror("epoll_ctl");
+    }
+}
+
+// Worker of the pool strategy: takes one ready descriptor at a time
+void *pool_worker(void *arg)
+{
+    int epoll_fd = *(int *)arg;
+    IOBuffer *buf = BufferPool::instance().acquire();
+    std::string to_engine;
+    while (true)
+    {
+        struct epoll_event ev;
+        int n = epoll_wait(epoll_fd, &ev, 1, -1);
+        if (n == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            perror("epoll_wait");
+            break;
+        }
+        int fd = ev.data.fd;
+        if (server.is_listener(fd))
+        {
+            accept_clients(fd, ACCEPT_FLAGS, [&](int newfd)
+                           { pool_arm(epoll_fd, newfd, EPOLL_CTL_ADD); });
+            pool_arm(epoll_fd, fd, EPOLL_CTL_MOD);
+        }
+        else
+        {
+            // The commands are queued for the engine before the socket is re-armed,
+            // so the next read of the client, by any worker, cannot overtake them
+            bool open = read_client(fd, buf, to_engine);
+            server.engine_writer->submit_throttled(to_engine);
+            to_engine.clear();
+            if (open)
+            {
+                pool_arm(epoll_fd, fd, EPOLL_CTL_MOD);
+            }
+        }
+    }
+    BufferPool::instance().unref(buf);
+    return NULL;
+}
+
+// A fixed pool of threads taking turns at a shared epoll set, so thousands of
+// connections need neither thousands of threads nor a single thread
+void serve_pool(int threads)
+{
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd == -1)
+    {
+        perror("epoll_create1");
+        exit(1);
+    }
+    start_service_threads();
+    for (int listener : server.listeners)
+    {
+        pool_arm(epoll_fd, listener, EPOLL_CTL_ADD);
+    }
+
+    std::vector<pthread_t> workers(threads);
+    for (pthread_t &worker : workers)
+    {
+        pthread_create(&worker, NULL, pool_worker, &epoll_fd);
+    }
+    for (pthread_t &worker : workers)
+    {
+        pthread_join(worker, NULL);
+    }
+}
+
+// ---------------------------------------------------------------- io_uring proactor
+
+// Kinds of operations in flight on the ring, in the high half of their user_data
+enum UringOp
+{
+    URING_ACCEPT,          // Multishot accept on a listener
+    URING_SCRAPE,          // Multishot accept on the metrics listener
+    URING_ENGINE_READ,     // Read of the engine's stdout
+    URING_ENGINE_WRITABLE, // Wait for the engine's stdin to be writable
+    URING_CLIENT_RECV,     // Receive from a client
+    URING_CLIENT_WRITABLE, // Wait for a backlogged client's socket to be writable
+    URING_CANCEL,          // Cancellation of a wait
+    URING_ACCEPT_RETRY     // Timeout before accepting again on a listener that failed
+};
+
+#define URING_GENERATION_MASK 0xFFFFFF // Bits of a connection's generation kept in a user_data
+#define URING_ACCEPT_RETRY_MS 100      // Pause of a listener whose accept ran out of descriptors
+
+// The user_data of an operation on a descriptor: the kind of operation in
+// the top byte, then the generation of the connection, then the descriptor
+// A client's operations carry its generation, so the completion (or the
+// cancellation) of an operation of a closed connection cannot be taken for
+// one of a new connection that got the same descriptor number
+uint64_t uring_tag(UringOp op, int fd, uint32_t generation = 0)
+{
+    return ((uint64_t)op << 56) | ((uint64_t)(generation & URING_GENERATION_MASK) << 32) | (uint32_t)fd;
+}
+
+// An operation on a descriptor
+struct io_uring_sqe uring_op(uint8_t opcode, UringOp op, int fd, uint32_t generation = 0)
+{
+    struct io_uring_sqe sqe;
+    memset(&sqe, 0, sizeof sqe);
+    sqe.opcode = opcode;
+    sqe.fd = fd;
+    sqe.user_data = uring_tag(op, fd, generation);
+    return sqe;
+}
+
+// Wait for a descriptor to be writable
+struct io_uring_sqe uring_poll_out(UringOp op, int fd, uint32_t generation = 0)
+{
+    struct io_uring_sqe sqe = uring_op(IORING_OP_POLL_ADD, op, fd, generation);
+    sqe.poll32_events = POLLOUT;
+    return sqe;
+}
+
+// A client of the io_uring strategy
+struct UringClient
+{
+    IOBuffer *buf;       // Receive buffer
+    uint32_t generation; // Number of the connection, masked by URING_GENERATION_MASK
+    bool polled;         // True while a URING_CLIENT_WRITABLE is in flight
+};
+
+// One thread that submits the accepts, receives and reads to an io_uring and
+// handles them as they complete: the kernel does the I/O, so a round costs
+// one system call however many descriptors were ready
+// The output to the clients is still written by the router without blocking;
+// the ring only tells when a backlogged socket takes more
+void serve_uring()
+{
+    make_engine_input_nonblocking();
+    IoUring ring(URING_ENTRIES);
+    PooledReader engine_reader;
+    std::map<int, UringClient> clients;  // Every client, by descriptor
+    uint32_t generations = 0;            // Connections accepted so far
+    std::set<int> single_accepts;        // Listeners whose kernel refused a multishot accept
+    bool engine_polled = false;          // True while a URING_ENGINE_WRITABLE is in flight
+
+    // A multishot accept completes once for every connection until it fails;
+    // a single accept (on kernels without multishot accepts) only once
+    auto accept_all = [&](UringOp op, int listener)
+    {
+        struct io_uring_sqe sqe = uring_op(IORING_OP_ACCEPT, op, listener);
+        if (!single_accepts.count(listener))
+        {
+            sqe.ioprio = IORING_ACCEPT_MULTISHOT;
+        }
+        sqe.accept_flags = SOCK_CLOEXEC;
+        ring.push(sqe);
+    };
+    // Accept again once an accept stopped: right away, after a pause while
+    // the process is out of descriptors or memory (accepting again at once
+    // would only fail again), or never after an error that does not clear
+    auto accept_again = [&](UringOp op, int listener, int res)
+    {
+        if (res == -EINVAL && !single_accepts.count(listener))
+        {
+            single_accepts.insert(listener);
+            accept_all(op, listener);
+            return;
+        }
+        if (res < 0 && res != -EAGAIN)
+        {
+            errno = -res;
+            perror("accept");
+        }
+        if (res == -EMFILE || res == -ENFILE || res == -ENOBUFS || res == -ENOMEM)
+        {
+            static const struct __kernel_timespec pause = {0, URING_ACCEPT_RETRY_MS * 1000000LL};
+            struct io_uring_sqe sqe = uring_op(IORING_OP_TIMEOUT, URING_ACCEPT_RETRY, listener);
+            sqe.fd = -1;
+            sqe.addr = (uint64_t)&pause;
+            sqe.len = 1;
+            ring.push(sqe);
+        }
+        else if (res != -EINVAL && res != -EBADF && res != -ENOTSOCK && res != -EOPNOTSUPP)
+        {
+            accept_all(op, listener);
+        }
+    };
+    auto read_engine = [&]()
+    {
+        struct io_uring_sqe sqe = uring_op(IORING_OP_READV, URING_ENGINE_READ, server.command_stdout_fd);
+        sqe.addr = (uint64_t)engine_reader.prepare();
+        sqe.len = IO_READV_BUFFERS;
+        sqe.off = (uint64_t)-1; // The pipe's current position
+        ring.push(sqe);
+    };
+    auto receive = [&](int fd, const UringClient &client)
+    {
+        struct io_uring_sqe sqe = uring_op(IORING_OP_RECV, URING_CLIENT_RECV, fd, client.generation);
+        sqe.addr = (uint64_t)client.buf->data;
+        sqe.len = IO_BUFFER_SIZE;
+        ring.push(sqe);
+    };
+
+    for (int listener : server.listeners)
+    {
+        accept_all(URING_ACCEPT, listener);
+    }
+    read_engine();
+    if (server.metrics_listener != -1)
+    {
+        accept_all(URING_SCRAPE, server.metrics_listener);
+    }
+
+    for (;;)
+    {
+        if (ring.submit(1) == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            perror("io_uring_enter");
+            exit(1);
+        }
+
+        std::string to_engine; // Lines for the engine's stdin gathered in this round
+        struct io_uring_cqe cqe;
+        while (ring.pop(cqe))
+        {
+            UringOp op = (UringOp)(cqe.user_data >> 56);
+            uint32_t generation = (uint32_t)(cqe.user_data >> 32) & URING_GENERATION_MASK;
+            int fd = (int)(uint32_t)cqe.user_data;
+            int res = cqe.res;
+            auto client = clients.find(fd);
+            if ((op == URING_CLIENT_RECV || op == URING_CLIENT_WRITABLE) &&
+                (client == clients.end() || client->second.generation != generation))
+            {
+                continue; // An operation of a connection that is gone
+            }
+            switch (op)
+            {
+            case URING_ACCEPT:
+                if (res >= 0 && add_client(res))
+                {
+                    UringClient &added = clients[res];
+                    added.buf = BufferPool::instance().acquire();
+                    added.generation = ++generations & URING_GENERATION_MASK;
+                    added.polled = false;
+                    receive(res, added);
+                }
+                if (!(cqe.flags & IORING_CQE_F_MORE))
+                {
+                    accept_again(URING_ACCEPT, fd, res);
+                }
+                break;
+            case URING_SCRAPE:
+                if (res >= 0)
+                {
+                    to_engine += server.router.add_scrape_client(res);
+                }
+                if (!(cqe.flags & IORING_CQE_F_MORE))
+                {
+                    accept_again(URING_SCRAPE, fd, res);
+                }
+                break;
+            case URING_ACCEPT_RETRY:
+                accept_all(server.is_listener(fd) ? URING_ACCEPT : URING_SCRAPE, fd);
+                break;
+            case URING_ENGINE_READ:
+                engine_reader.filled(res);
+                if (res <= 0)
+                {
+                    if (res == 0)
+                    {
+                        printf("server: command stdout closed\n");
+                    }
+                    else
+                    {
+                        errno = -res;
+                        perror("read");
+                    }
+                    close(fd);
+                }
+                else
+                {
+                    to_engine += server.router.on_engine_data(engine_reader.buffers(), engine_reader.buffer_count());
+                    read_engine();
+                }
+                break;
+            case URING_ENGINE_WRITABLE:
+                engine_polled = false;
+                break;
+            case URING_CLIENT_RECV:
+            {
+                UringClient &receiver = client->second;
+                if (res < 0)
+                {
+                    errno = -res;
+                }
+                if (on_client_input(fd, receiver.buf->data, res, to_engine))
+                {
+                    receive(fd, receiver);
+                    break;
+                }
+                // The socket is closed: its wait for writability, if any, is
+                // cancelled by its generation, not by the reusable number
+                BufferPool::instance().unref(receiver.buf);
+                if (receiver.polled)
+                {
+                    struct io_uring_sqe sqe = uring_op(IORING_OP_ASYNC_CANCEL, URING_CANCEL, fd);
+                    sqe.fd = -1;
+                    sqe.addr = uring_tag(URING_CLIENT_WRITABLE, fd, receiver.generation);
+                    ring.push(sqe);
+                }
+                clients.erase(client);
+                break;
+            }
+            case URING_CLIENT_WRITABLE:
+                client->second.polled = false;
+                if (res > 0)
+                {
+                    to_engine += server.router.on_client_writable(fd);
+                }
+                break;
+            case URING_CANCEL:
+                break;
+            }
+        }
+
+        if (!to_engine.empty())
+        {
+            server.engine_writer->queue(to_engine);
+        }
+        if (!server.engine_writer->flush() && !engine_polled)
+        {
+            engine_polled = true;
+            ring.push(uring_poll_out(URING_ENGINE_WRITABLE, server.command_stdin_fd));
+        }
+
+        // Wait for the backlogged sockets to take more of their output
+        for (int fd : server.router.backlogged_fds())
+        {
+            auto client = clients.find(fd);
+            if (client != clients.end() && !client->second.polled)
+            {
+                client->second.polled = true;
+                ring.push(uring_poll_out(URING_CLIENT_WRITABLE, fd, client->second.generation));
+            }
+        }
+    }
+}
+
+// ----------------------------------------------------------------
+
+// Parse the options, start the engine and serve with the strategy -s names
+// (default_strategy unless it names another)
+int run_server(int argc, char *argv[], ServerStrategy default_strategy)
+{
+    ServerOptions options = parse_server_options(argc, argv, default_strategy);
+    start_server(options);
+    switch (options.strategy)
+    {
+    case STRATEGY_POLL:
+        serve_poll();
+        break;
+    case STRATEGY_SELECT:
+        serve_select();
+        break;
+    case STRATEGY_EPOLL:
+        serve_epoll();
+        break;
+    case STRATEGY_THREADS:
+        serve_threads();
+        break;
+    case STRATEGY_POOL:
+        serve_pool(options.pool_threads);
+        break;
+    default:
+        serve_uring();
+        break;
+    }
+    delete server.engine_writer;
+    return 0;
+}
+
+#endif
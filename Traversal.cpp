@@ -0,0 +1,189 @@
+#ifndef TRAVERSAL_H
+#define TRAVERSAL_H
+
+#include <vector>
+#include <stdint.h>
+#include "SccKernel.cpp"
+using namespace std;
+
+// Breadth first search and topological sorting, written once for every edge
+// storage of Adjacency.cpp like the Kosaraju kernel
+// bfs_run() is a direction optimizing BFS: while the frontier is small it
+// expands it top-down along the out-edges, and once the frontier's edges
+// outnumber what is left to explore it switches to bottom-up: every vertex
+// not reached yet looks for a parent in the frontier along its in-edges and
+// stops at the first one, so the large middle levels of a search cost a
+// fraction of their edges. The frontier of a bottom-up level is a bitset, so
+// the test for a parent is one bit
+
+#define BFS_ALPHA 14 // Go bottom-up once the frontier's edges are over 1/14 of the unexplored edges
+#define BFS_BETA 24  // Go top-down again once the frontier has under 1/24 of the vertices
+
+// Breadth first search from source
+// level(distance, frontier, visited) is called for every level with the
+// vertices at that distance (a vector<int>) and the vertices reached so far;
+// the search stops when it returns false
+// edges is the number of edges of the graph, rev the reverse of g
+template <class Adjacency, class Level>
+void bfs_run(const Adjacency &g, const Adjacency &rev, size_t vertices, size_t edges, int source, Level level)
+{
+    VisitedSet visited(vertices);
+    VisitedSet in_frontier(vertices);
+    vector<int> frontier(1, source);
+    vector<int> next;
+    visited.set(source);
+    size_t frontier_edges = g.degree(source);
+    size_t unexplored = edges > frontier_edges ? edges - frontier_edges : 0;
+    bool bottom_up = false;
+    for (size_t distance = 0; !frontier.empty(); distance++)
+    {
+        if (!level(distance, frontier, visited))
+        {
+            return;
+        }
+        if (!bottom_up && frontier_edges > unexplored / BFS_ALPHA)
+        {
+            bottom_up = true;
+        }
+        else if (bottom_up && frontier.size() < vertices / BFS_BETA)
+        {
+            bottom_up = false;
+        }
+        next.clear();
+        size_t next_edges = 0;
+        if (!bottom_up)
+        {
+            for (int u : frontier)
+            {
+                auto c = g.cursor(u);
+                int w;
+                while (g.next(c, w))
+                {
+                    if (!visited.test(w))
+                    {
+                        visited.set(w);
+                        next.push_back(w);
+                        next_edges += g.degree(w);
+                    }
+                }
+            }
+        }
+        else
+        {
+            in_frontier.reset();
+            for (int u : frontier)
+            {
+                in_frontier.set(u);
+            }
+            // Skip the words of vertices that were all reached already
+            const uint64_t *words = visited.data();
+            for (size_t i = 0; i < (vertices + 63) / 64; i++)
+            {
+                uint64_t unvisited = ~words[i];
+                if (i == vertices / 64)
+                {
+                    unvisited &= (1ULL << (vertices % 64)) - 1;
+                }
+                for (; unvisited != 0; unvisited &= unvisited - 1)
+                {
+                    int v = (int)(i * 64 + __builtin_ctzll(unvisited));
+                    auto c = rev.cursor(v);
+                    int parent;
+                    while (rev.next(c, parent))
+                    {
+                        if (in_frontier.test(parent))
+                        {
+                            visited.set(v);
+                            next.push_back(v);
+                            next_edges += g.degree(v);
+                            break;
+                        }
+                    }
+                }
+            }
+        }
+        unexplored = unexplored > next_edges ? unexplored - next_edges : 0;
+        frontier.swap(next);
+        frontier_edges = next_edges;
+    }
+}
+
+// Kahn's algorithm: appends the vertices to order so that every edge goes
+// forward, as far as the graph allows
+// Returns false if the graph has a cycle; order then misses the vertices that
+// are on a cycle or after one, and cycle gets one of the cycles, in the
+// direction of its edges
+// A run given a control reports the vertices sorted there and stops early
+// (returning false, with an empty cycle) once it is cancelled
+template <class Adjacency>
+bool topo_run(const Adjacency &g, const Adjacency &rev, size_t vertices, vector<int> &order, vector<int> &cycle,
+              SccControl *control = nullptr)
+{
+    size_t steps = 0;
+    vector<uint32_t> in_degree(vertices);
+    for (size_t v = 0; v < vertices; v++)
+    {
+        in_degree[v] = rev.degree(v);
+        if (in_degree[v] == 0)
+        {
+            order.push_back(v);
+        }
+    }
+    for (size_t i = 0; i < order.size(); i++)
+    {
+        if (!scc_checkpoint(control, steps, i))
+        {
+            return false;
+        }
+        auto c = g.cursor(order[i]);
+        int w;
+        while (g.next(c, w))
+        {
+            if (--in_degree[w] == 0)
+            {
+                order.push_back(w);
+            }
+        }
+    }
+    if (order.size() == vertices)
+    {
+        return true;
+    }
+
+    // Every vertex left has a predecessor left: walk back along them until a
+    // vertex repeats
+    size_t start = 0;
+    while (in_degree[start] == 0)
+    {
+        start++;
+    }
+    VisitedSet on_walk(vertices);
+    vector<int> walk;
+    int v = start;
+    while (!on_walk.test(v))
+    {
+        on_walk.set(v);
+        walk.push_back(v);
+        auto c = rev.cursor(v);
+        int u = -1;
+        while (rev.next(c, u) && in_degree[u] == 0)
+        {
+            // Skip the predecessors that were sorted
+        }
+        v = u;
+    }
+    // The walk went against the edges: v, walk.back(), ..., up to v again
+    size_t first = 0;
+    while (walk[first] != v)
+    {
+        first++;
+    }
+    cycle.push_back(v);
+    for (size_t i = walk.size() - 1; i > first; i--)
+    {
+        cycle.push_back(walk[i]);
+    }
+    return false;
+}
+
+#endif
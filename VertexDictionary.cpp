@@ -0,0 +1,169 @@
+#ifndef VERTEX_DICTIONARY_H
+#define VERTEX_DICTIONARY_H
+
+#include <vector>
+#include <stdint.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define DICT_GROUP 16           // Slots probed together
+#define DICT_EMPTY ((int8_t)-128) // Control byte of an empty slot
+
+// Maps the 64-bit vertex ids chosen by the clients to dense indices 0..n-1
+// Open addressing in the style of a Swiss table: next to every slot a control
+// byte holds 7 bits of the key's hash, so a lookup compares the 16 control
+// bytes of a group at once (one SSE2 compare) and only touches the keys whose
+// hash bits match
+// Keys are never removed one by one; clear() forgets them all
+class VertexDictionary
+{
+private:
+    std::vector<int8_t> ctrl;    // Control byte of every slot: DICT_EMPTY or 7 bits of the hash
+    std::vector<uint64_t> keys;  // Key of every slot
+    std::vector<uint32_t> values; // Dense index of every slot
+    size_t count = 0;             // Number of keys stored
+    size_t group_mask = 0;        // Number of groups - 1
+
+    static uint64_t hash(uint64_t key)
+    {
+        key ^= key >> 33;
+        key *= 0xff51afd7ed558ccdULL;
+        key ^= key >> 33;
+        key *= 0xc4ceb9fe1a85ec53ULL;
+        key ^= key >> 33;
+        return key;
+    }
+
+    // Bit i is set when control byte i of the group equals tag
+    static unsigned match(const int8_t *group, int8_t tag)
+    {
+#ifdef __SSE2__
+        __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(group));
+        return _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(tag)));
+#else
+        unsigned mask = 0;
+        for (int i = 0; i < DICT_GROUP; i++)
+        {
+            mask |= (unsigned)(group[i] == tag) << i;
+        }
+        return mask;
+#endif
+    }
+
+    // Find the slot of a key, or the empty slot where it belongs
+    // Returns true if the key is present
+    bool probe(uint64_t key, size_t &slot) const
+    {
+        uint64_t h = hash(key);
+        int8_t tag = (int8_t)(h & 0x7f);
+        size_t group = (h >> 7) & group_mask;
+        for (size_t step = 1;; step++)
+        {
+            const int8_t *base = &ctrl[group * DICT_GROUP];
+            for (unsigned hits = match(base, tag); hits != 0; hits &= hits - 1)
+            {
+                size_t i = group * DICT_GROUP + __builtin_ctz(hits);
+                if (keys[i] == key)
+                {
+                    slot = i;
+                    return true;
+                }
+            }
+            unsigned empty = match(base, DICT_EMPTY);
+            if (empty != 0)
+            {
+                slot = group * DICT_GROUP + __builtin_ctz(empty);
+                return false;
+            }
+            group = (group + step) & group_mask; // Triangular probing visits every group
+        }
+    }
+
+    // Resize the table to a number of groups (a power of two) and re-insert the keys
+    void rehash(size_t groups)
+    {
+        std::vector<int8_t> old_ctrl = std::move(ctrl);
+        std::vector<uint64_t> old_keys = std::move(keys);
+        std::vector<uint32_t> old_values = std::move(values);
+        ctrl.assign(groups * DICT_GROUP, DICT_EMPTY);
+        keys.assign(groups * DICT_GROUP, 0);
+        values.assign(groups * DICT_GROUP, 0);
+        group_mask = groups - 1;
+        for (size_t i = 0; i < old_ctrl.size(); i++)
+        {
+            if (old_ctrl[i] != DICT_EMPTY)
+            {
+                size_t slot;
+                probe(old_keys[i], slot);
+                ctrl[slot] = (int8_t)(hash(old_keys[i]) & 0x7f);
+                keys[slot] = old_keys[i];
+                values[slot] = old_values[i];
+            }
+        }
+    }
+
+public:
+    VertexDictionary()
+    {
+        rehash(1);
+    }
+
+    size_t size() const { return count; }
+
+    // Forget every key, keeping room for expected keys
+    void clear(size_t expected = 0)
+    {
+        count = 0;
+        size_t groups = 1;
+        while (groups * DICT_GROUP * 7 / 8 < expected)
+        {
+            groups *= 2;
+        }
+        ctrl.clear();
+        rehash(groups);
+    }
+
+    // Dense index of a key, or -1 if it is unknown
+    long find(uint64_t key) const
+    {
+        size_t slot;
+        return probe(key, slot) ? (long)values[slot] : -1;
+    }
+
+    // Dense index of a key; an unknown key is added with value next
+    // Sets added when the key was new
+    uint32_t insert(uint64_t key, uint32_t next, bool &added)
+    {
+        size_t slot;
+        added = !probe(key, slot);
+        if (!added)
+        {
+            return values[slot];
+        }
+        if ((count + 1) * 8 > ctrl.size() * 7)
+        {
+            // Keep the load under 7/8 so probe chains stay short
+            rehash((group_mask + 1) * 2);
+            probe(key, slot);
+        }
+        ctrl[slot] = (int8_t)(hash(key) & 0x7f);
+        keys[slot] = key;
+        values[slot] = next;
+        count++;
+        return next;
+    }
+
+    // Change the dense index of a known key
+    void assign(uint64_t key, uint32_t value)
+    {
+        size_t slot;
+        if (probe(key, slot))
+        {
+            values[slot] = value;
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,302 @@
+#ifndef WAL_H
+#define WAL_H
+
+#include <string>
+#include <string_view>
+#include <algorithm>
+#include <atomic>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/eventfd.h>
+#include "Metrics.cpp"
+
+// Append-only write-ahead log of the commands that change the graph, one
+// command line per record
+// Appending only copies the line into a buffer; a flusher thread writes the
+// buffer and calls fdatasync() once per commit interval, so every record that
+// arrived during the interval shares one sync (group commit). The caller
+// learns through wake_fd when records became durable and holds their
+// responses until then
+// reset() starts the log over (a Newgraph makes the history before it
+// useless, and a checkpoint replaces it with a snapshot of the graph): the
+// flusher writes the new log to a temporary file and renames it over the old
+// one, so a crash leaves either the old log or the new one
+class WriteAheadLog
+{
+private:
+    std::string path;                     // The log file
+    int fd = -1;                          // The open log file
+    uint64_t interval_us = 0;             // Time records are gathered before a sync
+    pthread_t flusher;                    // Writes and syncs the buffer
+    bool started = false;                 // True while the flusher runs
+    pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER; // Protects the fields below
+    pthread_cond_t has_records = PTHREAD_COND_INITIALIZER; // Signalled on append, reset and close
+    std::string buffer;                   // Records not written yet
+    bool restart = false;                 // The buffer replaces the whole file
+    bool stopping = false;                // Set by close()
+    uint64_t appended = 0;                // Records appended since startup
+    uint64_t logged = 0;                  // Records in the log since it was last started over
+    std::atomic<uint64_t> durable{0};     // Records synced to the disk
+
+    // Write a whole buffer to a file descriptor
+    static bool write_fully(int to, const std::string &data)
+    {
+        size_t written = 0;
+        while (written < data.size())
+        {
+            ssize_t n = write(to, data.data() + written, data.size() - written);
+            if (n == -1)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                return false;
+            }
+            written += n;
+        }
+        return true;
+    }
+
+    // Replace the log with data: write a temporary file, sync it and rename it
+    bool rewrite(const std::string &data)
+    {
+        std::string tmp = path + ".tmp";
+        int tmp_fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+        if (tmp_fd == -1)
+        {
+            perror("open");
+            return false;
+        }
+        if (!write_fully(tmp_fd, data) || fdatasync(tmp_fd) == -1 || rename(tmp.c_str(), path.c_str()) == -1)
+        {
+            perror("wal rewrite");
+            ::close(tmp_fd);
+            return false;
+        }
+        // The rename itself is durable once the directory is synced
+        std::string dir_path = path;
+        int dir_fd = ::open(dirname(&dir_path[0]), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (dir_fd != -1)
+        {
+            fsync(dir_fd);
+            ::close(dir_fd);
+        }
+        ::close(fd);
+        fd = tmp_fd;
+        return true;
+    }
+
+    static void *flush_main(void *arg)
+    {
+        WriteAheadLog *wal = static_cast<WriteAheadLog *>(arg);
+        std::string batch;
+        while (true)
+        {
+            pthread_mutex_lock(&wal->lock);
+            while (wal->buffer.empty() && !wal->restart && !wal->stopping)
+            {
+                pthread_cond_wait(&wal->has_records, &wal->lock);
+            }
+            if (wal->buffer.empty() && !wal->restart)
+            {
+                pthread_mutex_unlock(&wal->lock);
+                return nullptr;
+            }
+            bool gather = wal->interval_us > 0 && !wal->stopping;
+            pthread_mutex_unlock(&wal->lock);
+
+            if (gather)
+            {
+                // Let the records of the whole interval join this commit
+                usleep(wal->interval_us);
+            }
+
+            pthread_mutex_lock(&wal->lock);
+            batch.swap(wal->buffer);
+            bool restart = wal->restart;
+            wal->restart = false;
+            uint64_t covered = wal->appended;
+            pthread_mutex_unlock(&wal->lock);
+
+            uint64_t start = now_ns();
+            bool ok = restart ? wal->rewrite(batch)
+                              : write_fully(wal->fd, batch) && fdatasync(wal->fd) == 0;
+            if (!ok)
+            {
+                // Acknowledging records that are not on the disk would break
+                // the promise of the log
+                perror("wal");
+                exit(1);
+            }
+            wal->sync_us.record((now_ns() - start) / 1000);
+            wal->syncs.add();
+            wal->bytes.add(batch.size());
+            batch.clear();
+            wal->durable.store(covered, std::memory_order_release);
+            uint64_t one = 1;
+            if (write(wal->wake_fd, &one, sizeof one) == -1)
+            {
+                perror("write");
+            }
+        }
+    }
+
+public:
+    int wake_fd = -1;          // eventfd signalled after every sync
+    Counter records;           // Records appended
+    Counter bytes;             // Bytes written
+    Counter syncs;             // Commits (one fdatasync each)
+    Counter checkpoints;       // Times the log was replaced by a snapshot
+    LatencyHistogram sync_us;  // Duration of a write and its sync
+
+    ~WriteAheadLog() { close(); }
+
+    bool enabled() const { return fd != -1; }
+
+    // Open the log, appending to what it holds, and start the flusher
+    // A record torn by a crash (a last line without its newline) is cut off
+    bool open(const std::string &file, uint64_t commit_interval_us)
+    {
+        path = file;
+        interval_us = commit_interval_us;
+        fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (fd == -1)
+        {
+            perror("open");
+            return false;
+        }
+        off_t size = lseek(fd, 0, SEEK_END);
+        off_t keep = size;
+        char c;
+        while (keep > 0 && pread(fd, &c, 1, keep - 1) == 1 && c != '\n')
+        {
+            keep--;
+        }
+        if (keep != size && ftruncate(fd, keep) == -1)
+        {
+            perror("ftruncate");
+            return false;
+        }
+        // O_APPEND from here on: every write lands at the end
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_APPEND);
+        wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (wake_fd == -1)
+        {
+            perror("eventfd");
+            return false;
+        }
+        if (pthread_create(&flusher, nullptr, flush_main, this) != 0)
+        {
+            perror("pthread_create");
+            return false;
+        }
+        started = true;
+        return true;
+    }
+
+    // Call f for every record of the log, in order
+    template <class F>
+    void replay(F f)
+    {
+        FILE *in = fopen(path.c_str(), "r");
+        if (in == nullptr)
+        {
+            return;
+        }
+        char *line = nullptr;
+        size_t capacity = 0;
+        ssize_t length;
+        while ((length = getline(&line, &capacity, in)) > 0)
+        {
+            if (line[length - 1] != '\n')
+            {
+                break; // Torn record
+            }
+            f(std::string(line, length - 1));
+            logged++;
+        }
+        free(line);
+        fclose(in);
+    }
+
+    // Add a record; returns its number, durable once durableCount() reaches it
+    uint64_t append(std::string_view record)
+    {
+        pthread_mutex_lock(&lock);
+        buffer += record;
+        buffer += '\n';
+        uint64_t number = ++appended;
+        logged++;
+        pthread_cond_signal(&has_records);
+        pthread_mutex_unlock(&lock);
+        records.add();
+        return number;
+    }
+
+    // Start the log over with a first set of records (newline terminated)
+    uint64_t reset(const std::string &first)
+    {
+        pthread_mutex_lock(&lock);
+        buffer = first;
+        restart = true;
+        uint64_t number = ++appended;
+        logged = std::count(first.begin(), first.end(), '\n');
+        pthread_cond_signal(&has_records);
+        pthread_mutex_unlock(&lock);
+        records.add();
+        return number;
+    }
+
+    // Number of records appended so far
+    uint64_t appendedCount()
+    {
+        pthread_mutex_lock(&lock);
+        uint64_t count = appended;
+        pthread_mutex_unlock(&lock);
+        return count;
+    }
+
+    // Number of records the log holds (or will hold once written)
+    uint64_t loggedCount()
+    {
+        pthread_mutex_lock(&lock);
+        uint64_t count = logged;
+        pthread_mutex_unlock(&lock);
+        return count;
+    }
+
+    // Number of records on the disk
+    uint64_t durableCount() const { return durable.load(std::memory_order_acquire); }
+
+    // Sync what is buffered and stop the flusher
+    void close()
+    {
+        if (started)
+        {
+            pthread_mutex_lock(&lock);
+            stopping = true;
+            pthread_cond_signal(&has_records);
+            pthread_mutex_unlock(&lock);
+            pthread_join(flusher, nullptr);
+            started = false;
+        }
+        if (fd != -1)
+        {
+            ::close(fd);
+            fd = -1;
+        }
+        if (wake_fd != -1)
+        {
+            ::close(wake_fd);
+            wake_fd = -1;
+        }
+    }
+};
+
+#endif
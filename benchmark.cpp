@@ -0,0 +1,777 @@
+#include <iostream>
+#include <vector>
+#include <random>
+#include <unordered_map>
+#include <algorithm>
+#include <sstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "Graph.cpp"
+#include "Metrics.cpp"
+#include "Wal.cpp"
+#include "CommandParser.cpp"
+using namespace std;
+
+// Benchmark harness for the engine's data structures
+// Usage: ./bench [vertices] [edges per vertex]
+//        ./bench storm [connections] [port]   (against a running server)
+
+// A graph with good locality (most edges stay within a small window and the
+// vertices form long cycles) whose vertex numbers were shuffled, the way ids
+// chosen by clients usually are
+vector<pair<int, int>> make_scrambled_graph(int vertices, int degree, mt19937 &rng)
+{
+    vector<int> label(vertices);
+    for (int i = 0; i < vertices; i++)
+    {
+        label[i] = i + 1;
+    }
+    shuffle(label.begin(), label.end(), rng);
+
+    uniform_int_distribution<int> window(-64, 64);
+    uniform_int_distribution<int> anywhere(0, vertices - 1);
+    vector<pair<int, int>> edges;
+    edges.reserve((size_t)vertices * degree);
+    for (int i = 0; i < vertices; i++)
+    {
+        edges.emplace_back(label[i], label[(i + 1) % vertices]);
+        for (int k = 1; k < degree; k++)
+        {
+            int j = (k == degree - 1 && i % 16 == 0) ? anywhere(rng) : (i + window(rng) + vertices) % vertices;
+            edges.emplace_back(label[i], label[j]);
+        }
+    }
+    shuffle(edges.begin(), edges.end(), rng); // Edges arrive in no particular order either
+    return edges;
+}
+
+// Load the edges into the engine's graph
+void load(Graph *graph, int vertices, const vector<pair<int, int>> &edges, ostream &out)
+{
+    graph->newGraph(vertices, edges.size(), out);
+    for (const auto &edge : edges)
+    {
+        graph->newEdge(edge.first, edge.second, out);
+    }
+}
+
+// Milliseconds since start
+double elapsed_ms(uint64_t start)
+{
+    return (now_ns() - start) / 1e6;
+}
+
+// Time Kosaraju's algorithm with every reorder mode
+void bench_reorder(int vertices, const vector<pair<int, int>> &edges)
+{
+    Graph *graph = Graph::getInstance();
+    ostream null_out(nullptr); // Discards the SCC listing
+    double baseline = 0;
+    printf("reorder: %d vertices, %zu edges\n", vertices, edges.size());
+    printf("  %-8s %12s %12s %9s\n", "mode", "reorder ms", "K ms", "speedup");
+    for (int m = REORDER_NONE; m <= REORDER_DEGREE; m++)
+    {
+        ReorderMode mode = static_cast<ReorderMode>(m);
+        load(graph, vertices, edges, null_out);
+        graph->setReorderMode(mode);
+        uint64_t start = now_ns();
+        graph->reorder(mode);
+        double reorder_ms = elapsed_ms(start);
+
+        double best = 0;
+        for (int run = 0; run < 3; run++)
+        {
+            start = now_ns();
+            graph->kosaraju(null_out);
+            double ms = elapsed_ms(start);
+            best = (run == 0 || ms < best) ? ms : best;
+        }
+        if (mode == REORDER_NONE)
+        {
+            baseline = best;
+        }
+        printf("  %-8s %12.1f %12.1f %8.2fx\n", reorder_mode_name(mode), reorder_ms, best, baseline / best);
+    }
+    printf("  largest SCC %d of %d vertices, %d SCCs\n", graph->get_max_scc(), vertices, graph->get_scc_count());
+}
+
+// Compare the memory and the K time of the storage modes
+void bench_storage(int vertices, const vector<pair<int, int>> &edges)
+{
+    Graph *graph = Graph::getInstance();
+    ostream null_out(nullptr);
+    printf("storage: %d vertices, %zu edges\n", vertices, edges.size());
+    printf("  %-8s %-8s %12s %12s %12s\n", "storage", "reorder", "load ms", "bytes/edge", "K ms");
+    for (int s = STORAGE_LIST; s <= STORAGE_COMPACT; s++)
+    {
+        for (ReorderMode mode : {REORDER_NONE, REORDER_BFS})
+        {
+            StorageMode storage = static_cast<StorageMode>(s);
+            graph->newGraph(0, 0, null_out);
+            graph->setStorageMode(storage);
+            uint64_t start = now_ns();
+            load(graph, vertices, edges, null_out);
+            graph->reorder(mode);
+            double load_ms = elapsed_ms(start);
+            double best = 0;
+            for (int run = 0; run < 3; run++)
+            {
+                start = now_ns();
+                graph->kosaraju(null_out);
+                double ms = elapsed_ms(start);
+                best = (run == 0 || ms < best) ? ms : best;
+            }
+            printf("  %-8s %-8s %12.1f %12.1f %12.1f\n", storage_mode_name(storage), reorder_mode_name(mode), load_ms,
+                   (double)graph->getAdjacencyBytes() / edges.size(), best);
+        }
+    }
+    graph->setStorageMode(STORAGE_LIST);
+}
+
+// Time the vertex dictionary against std::unordered_map on sparse 64-bit ids
+void bench_ids(int vertices, mt19937 &rng)
+{
+    mt19937_64 rng64(rng());
+    vector<uint64_t> keys(vertices);
+    for (auto &key : keys)
+    {
+        key = rng64();
+    }
+    printf("ids: %d sparse 64-bit vertex ids\n", vertices);
+    printf("  %-14s %12s %12s\n", "map", "insert ns", "lookup ns");
+
+    VertexDictionary dict;
+    uint64_t start = now_ns();
+    for (int i = 0; i < vertices; i++)
+    {
+        bool added;
+        dict.insert(keys[i], i, added);
+    }
+    double insert_ns = (double)(now_ns() - start) / vertices;
+    long sum = 0;
+    start = now_ns();
+    for (int i = vertices - 1; i >= 0; i--)
+    {
+        sum += dict.find(keys[i]);
+    }
+    double lookup_ns = (double)(now_ns() - start) / vertices;
+    printf("  %-14s %12.1f %12.1f\n", "dictionary", insert_ns, lookup_ns);
+
+    unordered_map<uint64_t, uint32_t> map;
+    start = now_ns();
+    for (int i = 0; i < vertices; i++)
+    {
+        map.emplace(keys[i], i);
+    }
+    insert_ns = (double)(now_ns() - start) / vertices;
+    start = now_ns();
+    for (int i = vertices - 1; i >= 0; i--)
+    {
+        sum -= map.find(keys[i])->second;
+    }
+    lookup_ns = (double)(now_ns() - start) / vertices;
+    printf("  %-14s %12.1f %12.1f\n", "unordered_map", insert_ns, lookup_ns);
+    if (sum != 0)
+    {
+        printf("  dictionary and unordered_map disagree\n");
+    }
+}
+
+// Best of three runs of the SCC kernel with an index type, in milliseconds
+template <class Index, class Adjacency>
+double time_kernel(const Adjacency &g, const Adjacency &rev, int vertices)
+{
+    double best = 0;
+    for (int run = 0; run < 3; run++)
+    {
+        SccResult result;
+        size_t listed = 0;
+        uint64_t start = now_ns();
+        scc_kernel<Index, true>(g, rev, vertices, [&](const vector<Index> &component)
+                          { listed += component.size(); },
+                          result, nullptr);
+        double ms = elapsed_ms(start);
+        best = (run == 0 || ms < best) ? ms : best;
+        if (listed != (size_t)vertices)
+        {
+            printf("  the kernel lost vertices\n");
+        }
+    }
+    return best;
+}
+
+// Fill a storage pair with the edges and time the kernel with 16-bit indices
+// (when the graph is small enough) and 32-bit indices
+template <class Adjacency>
+void bench_kernel_on(const char *name, int vertices, const vector<pair<int, int>> &edges)
+{
+    Adjacency g, rev;
+    g.clear(vertices);
+    rev.clear(vertices);
+    for (int v = 0; v < vertices; v++)
+    {
+        g.addVertex();
+        rev.addVertex();
+    }
+    for (const auto &edge : edges)
+    {
+        g.add(edge.first - 1, edge.second - 1);
+        rev.add(edge.second - 1, edge.first - 1);
+    }
+    g.prepare();
+    rev.prepare();
+    char ms16[16] = "-";
+    if (vertices <= 65536)
+    {
+        snprintf(ms16, sizeof ms16, "%.2f", time_kernel<uint16_t>(g, rev, vertices));
+    }
+    printf("  %-14s %10s %10.2f %14.1f\n", name, ms16, time_kernel<uint32_t>(g, rev, vertices),
+           (double)(g.memoryBytes(edges.size()) + rev.memoryBytes(edges.size())) / edges.size());
+}
+
+// Time the SCC kernel on every storage, with both index widths for a graph
+// that fits 16-bit indices
+void bench_kernels(int vertices, int degree, mt19937 &rng)
+{
+    int small = min(vertices, 8192);
+    vector<pair<int, int>> edges = make_scrambled_graph(small, degree, rng);
+    for (int pass = 0; pass < 2; pass++)
+    {
+        int n = pass == 0 ? small : vertices;
+        if (pass == 1)
+        {
+            if (vertices == small)
+            {
+                break;
+            }
+            edges = make_scrambled_graph(vertices, degree, rng);
+        }
+        printf("kernels: %d vertices, %zu edges\n", n, edges.size());
+        printf("  %-14s %10s %10s %14s\n", "storage", "16-bit ms", "32-bit ms", "bytes/edge");
+        bench_kernel_on<ListAdjacency>("list", n, edges);
+        bench_kernel_on<DequeAdjacency>("deque", n, edges);
+        if (n <= 65536)
+        {
+            bench_kernel_on<CsrAdjacency<uint16_t>>("csr16", n, edges);
+        }
+        bench_kernel_on<CsrAdjacency<uint32_t>>("csr32", n, edges);
+        bench_kernel_on<CompressedAdjacency>("compact", n, edges);
+        if (n <= 16384)
+        {
+            bench_kernel_on<BitMatrixAdjacency>("bitmatrix", n, edges);
+        }
+    }
+}
+
+// Time every K query mode: the traversal is the same, the summary modes only
+// skip collecting and formatting the vertices; a subset query searches a
+// thousand vertices of the graph
+void bench_queries(int vertices, const vector<pair<int, int>> &edges)
+{
+    Graph *graph = Graph::getInstance();
+    ostream null_out(nullptr);
+    graph->setReorderMode(REORDER_NONE);
+    load(graph, vertices, edges, null_out);
+    graph->prepareScc();
+    printf("queries: %d vertices, %zu edges\n", vertices, edges.size());
+    printf("  %-14s %12s %14s\n", "K", "ms", "answer bytes");
+    const char *queries[] = {"", "count", "top 10", "histogram"};
+    for (const char *params : queries)
+    {
+        SccQuery query;
+        parse_scc_query(params, query);
+        double best = 0;
+        size_t bytes = 0;
+        for (int run = 0; run < 3; run++)
+        {
+            ostringstream out;
+            SccResult result;
+            uint64_t start = now_ns();
+            graph->querySccs(query, out, result);
+            double ms = elapsed_ms(start);
+            best = (run == 0 || ms < best) ? ms : best;
+            bytes = out.str().size();
+        }
+        printf("  %-14s %12.1f %14zu\n", *params ? params : "(list)", best, bytes);
+    }
+
+    // A region query only touches the region: time the subgraph of 1000 vertices
+    SccQuery subset;
+    subset.region = SCC_SUBSET;
+    for (int v = 1; v <= min(vertices, 1000); v++)
+    {
+        subset.vertices.push_back(v);
+    }
+    double best = 0;
+    for (int run = 0; run < 3; run++)
+    {
+        ostringstream out;
+        SccResult result;
+        uint64_t start = now_ns();
+        graph->querySccs(subset, out, result);
+        double ms = elapsed_ms(start);
+        best = (run == 0 || ms < best) ? ms : best;
+    }
+    printf("  %-14s %12.3f\n", "subset 1000", best);
+}
+
+// Breadth first search that only goes top-down, the reference bfs_run() is
+// checked and timed against; returns the number of vertices at every distance
+template <class Adjacency>
+vector<size_t> top_down_levels(const Adjacency &g, size_t vertices, int source)
+{
+    VisitedSet visited(vertices);
+    vector<int> frontier(1, source), next;
+    vector<size_t> levels;
+    visited.set(source);
+    while (!frontier.empty())
+    {
+        levels.push_back(frontier.size());
+        next.clear();
+        for (int u : frontier)
+        {
+            g.forEach(u, [&](int w)
+                      {
+                          if (!visited.test(w))
+                          {
+                              visited.set(w);
+                              next.push_back(w);
+                          }
+                      });
+        }
+        frontier.swap(next);
+    }
+    return levels;
+}
+
+// Time the BFS from a few sources against a top-down only BFS, and the cycle
+// check, on the scrambled graph (long paths: many small levels) and on a
+// uniformly random one (a few huge levels, where bottom-up pays off)
+void bench_traversal(int vertices, const vector<pair<int, int>> &scrambled, mt19937 &rng)
+{
+    uniform_int_distribution<int> anywhere(1, vertices);
+    vector<pair<int, int>> random_edges(scrambled.size());
+    for (auto &edge : random_edges)
+    {
+        edge = make_pair(anywhere(rng), anywhere(rng));
+    }
+    printf("traversal: %d vertices, %zu edges\n", vertices, scrambled.size());
+    printf("  %-10s %8s %14s %14s %10s %12s\n", "graph", "levels", "top-down ms", "optimized ms", "speedup", "HasCycle ms");
+    for (int pass = 0; pass < 2; pass++)
+    {
+        const vector<pair<int, int>> &edges = pass == 0 ? scrambled : random_edges;
+        CsrAdjacency<uint32_t> g, rev;
+        g.clear(vertices);
+        rev.clear(vertices);
+        for (int v = 0; v < vertices; v++)
+        {
+            g.addVertex();
+            rev.addVertex();
+        }
+        for (const auto &edge : edges)
+        {
+            g.add(edge.first - 1, edge.second - 1);
+            rev.add(edge.second - 1, edge.first - 1);
+        }
+        g.prepare();
+        rev.prepare();
+        double top_down_ms = 0, optimized_ms = 0;
+        size_t depth = 0;
+        for (int run = 0; run < 4; run++)
+        {
+            int source = anywhere(rng) - 1;
+            uint64_t start = now_ns();
+            vector<size_t> expected = top_down_levels(g, vertices, source);
+            top_down_ms += elapsed_ms(start);
+            vector<size_t> levels;
+            start = now_ns();
+            bfs_run(g, rev, vertices, edges.size(), source,
+                    [&](size_t, const vector<int> &frontier, const VisitedSet &)
+                    {
+                        levels.push_back(frontier.size());
+                        return true;
+                    });
+            optimized_ms += elapsed_ms(start);
+            if (levels != expected)
+            {
+                printf("  BFS levels differ from the top-down search\n");
+                return;
+            }
+            depth = max(depth, levels.size());
+        }
+        vector<int> order, cycle;
+        uint64_t start = now_ns();
+        topo_run(g, rev, vertices, order, cycle);
+        double cycle_ms = elapsed_ms(start);
+        printf("  %-10s %8zu %14.1f %14.1f %9.1fx %12.1f\n", pass == 0 ? "scrambled" : "random", depth,
+               top_down_ms / 4, optimized_ms / 4, top_down_ms / optimized_ms, cycle_ms);
+    }
+}
+
+// A hardware event of this thread, counted with perf_event_open when the
+// kernel and the machine allow it (not in most VMs, nor with
+// kernel.perf_event_paranoid above 2)
+class PerfCounter
+{
+private:
+    int fd = -1;
+
+public:
+    PerfCounter(uint32_t type, uint64_t config)
+    {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof attr);
+        attr.size = sizeof attr;
+        attr.type = type;
+        attr.config = config;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+    }
+
+    ~PerfCounter()
+    {
+        if (fd != -1)
+        {
+            close(fd);
+        }
+    }
+
+    bool ok() const { return fd != -1; }
+
+    void start()
+    {
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+
+    uint64_t stop()
+    {
+        uint64_t count = 0;
+        ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(fd, &count, sizeof count) != sizeof count)
+        {
+            count = 0;
+        }
+        return count;
+    }
+};
+
+// Anonymous memory of this process backed by transparent huge pages, in KB
+long anon_huge_kb()
+{
+    FILE *file = fopen("/proc/self/smaps_rollup", "r");
+    if (file == NULL)
+    {
+        return -1;
+    }
+    char line[256];
+    long kb = -1;
+    while (fgets(line, sizeof line, file) != NULL)
+    {
+        if (sscanf(line, "AnonHugePages: %ld kB", &kb) == 1)
+        {
+            break;
+        }
+    }
+    fclose(file);
+    return kb;
+}
+
+// Time the SCC kernel on CSR storage with every huge page mode, counting the
+// dTLB misses of the traversal
+// "explicit" needs a reserved pool (sysctl vm.nr_hugepages=N) and falls back
+// to transparent huge pages without one
+void bench_huge_pages(int vertices, const vector<pair<int, int>> &edges)
+{
+    PerfCounter dtlb(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                                             (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+    printf("huge pages: %d vertices, %zu edges%s\n", vertices, edges.size(),
+           dtlb.ok() ? "" : " (dTLB counter unavailable here)");
+    printf("  %-10s %10s %14s %14s %14s\n", "mode", "K ms", "dTLB misses", "explicit MB", "THP MB");
+    uint64_t baseline = 0;
+    for (int m = HUGE_PAGES_OFF; m < HUGE_PAGES_COUNT; m++)
+    {
+        huge_pages().mode = m;
+        huge_pages().explicit_bytes = 0;
+        uint64_t explicit_bytes;
+        long thp_kb;
+        double best = 0;
+        uint64_t misses = 0;
+        {
+            CsrAdjacency<uint32_t> g, rev;
+            g.clear(vertices);
+            rev.clear(vertices);
+            for (int v = 0; v < vertices; v++)
+            {
+                g.addVertex();
+                rev.addVertex();
+            }
+            for (const auto &edge : edges)
+            {
+                g.add(edge.first - 1, edge.second - 1);
+                rev.add(edge.second - 1, edge.first - 1);
+            }
+            g.prepare();
+            rev.prepare();
+            explicit_bytes = huge_pages().explicit_bytes;
+            thp_kb = anon_huge_kb();
+            for (int run = 0; run < 3; run++)
+            {
+                SccResult result;
+                if (dtlb.ok())
+                {
+                    dtlb.start();
+                }
+                uint64_t start = now_ns();
+                scc_kernel<uint32_t, false>(g, rev, vertices, [](size_t) {}, result, nullptr);
+                double ms = elapsed_ms(start);
+                uint64_t count = dtlb.ok() ? dtlb.stop() : 0;
+                if (run == 0 || ms < best)
+                {
+                    best = ms;
+                    misses = count;
+                }
+            }
+        }
+        char misses_text[32] = "-";
+        if (dtlb.ok())
+        {
+            if (m == HUGE_PAGES_OFF)
+            {
+                baseline = misses;
+                snprintf(misses_text, sizeof misses_text, "%llu", (unsigned long long)misses);
+            }
+            else
+            {
+                snprintf(misses_text, sizeof misses_text, "%llu (%.0f%%)", (unsigned long long)misses,
+                         baseline ? 100.0 * misses / baseline : 0.0);
+            }
+        }
+        printf("  %-10s %10.1f %14s %14.1f %14.1f\n", huge_page_mode_names[m], best, misses_text,
+               explicit_bytes / 1048576.0, thp_kb / 1024.0);
+    }
+    huge_pages().mode = HUGE_PAGES_OFF;
+}
+
+// Time the command parser on a batch of Newedge lines against the
+// istringstream and stoi parsing it replaced
+void bench_parser(int commands, mt19937 &rng)
+{
+    uniform_int_distribution<int> vertex(1, 1000000);
+    string batch;
+    for (int i = 0; i < commands; i++)
+    {
+        batch += "Newedge " + to_string(vertex(rng)) + "," + to_string(vertex(rng)) + "\n";
+    }
+    printf("parser: %d Newedge commands, %zu bytes\n", commands, batch.size());
+    printf("  %-14s %12s %14s\n", "parser", "ns/command", "Mcommands/s");
+
+    uint64_t sum = 0;
+    uint64_t start = now_ns();
+    size_t pos = 0;
+    size_t newline;
+    while ((newline = batch.find('\n', pos)) != string::npos)
+    {
+        istringstream iss(batch.substr(pos, newline - pos));
+        string action, params;
+        iss >> action;
+        getline(iss, params);
+        params.erase(remove(params.begin(), params.end(), ' '), params.end());
+        size_t comma = params.find(',');
+        if (action == "Newedge" && comma != string::npos)
+        {
+            sum += stoull(params.substr(0, comma)) + stoull(params.substr(comma + 1));
+        }
+        pos = newline + 1;
+    }
+    double ns = (double)(now_ns() - start) / commands;
+    printf("  %-14s %12.1f %14.1f\n", "istringstream", ns, 1000 / ns);
+
+    uint64_t check = 0;
+    start = now_ns();
+    for_each_line(batch.data(), batch.size(), [&](string_view line)
+                  {
+                      Command command = parse_command(line);
+                      uint64_t u, v;
+                      if (command.verb == VERB_NEWEDGE && scan_pair(command.params, u, v))
+                      {
+                          check += u + v;
+                      }
+                  });
+    ns = (double)(now_ns() - start) / commands;
+    printf("  %-14s %12.1f %14.1f\n", "CommandParser", ns, 1000 / ns);
+    if (check != sum)
+    {
+        printf("  the parsers disagree\n");
+    }
+}
+
+// Time the write-ahead log: the cost of an append, and how many records share
+// a sync with group commit against one sync per record
+void bench_wal(int records)
+{
+    const char *path = "bench.wal";
+    printf("wal: %d Newedge records\n", records);
+    printf("  %-14s %12s %12s %14s %12s\n", "commit", "append ns", "syncs", "records/sync", "total ms");
+
+    // One write and one sync per record
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+    int synced = min(records, 2000);
+    uint64_t start = now_ns();
+    for (int i = 0; i < synced; i++)
+    {
+        string record = "Newedge " + to_string(i) + "," + to_string(i + 1) + "\n";
+        if (write(fd, record.data(), record.size()) == -1 || fdatasync(fd) == -1)
+        {
+            perror("wal");
+            break;
+        }
+    }
+    double per_record_ns = (double)(now_ns() - start) / synced;
+    close(fd);
+    printf("  %-14s %12.0f %12d %14d %12.1f\n", "every record", per_record_ns, synced, 1, per_record_ns * records / 1e6);
+
+    for (double interval_ms : {0.0, 1.0, 5.0})
+    {
+        unlink(path);
+        WriteAheadLog wal;
+        wal.open(path, (uint64_t)(interval_ms * 1000));
+        start = now_ns();
+        for (int i = 0; i < records; i++)
+        {
+            wal.append("Newedge " + to_string(i) + "," + to_string(i + 1));
+        }
+        double append_ns = (double)(now_ns() - start) / records;
+        while (wal.durableCount() < (uint64_t)records)
+        {
+            usleep(100);
+        }
+        double total_ms = elapsed_ms(start);
+        uint64_t syncs = wal.syncs.get();
+        char name[32];
+        snprintf(name, sizeof name, "group %.0f ms", interval_ms);
+        printf("  %-14s %12.1f %12llu %14llu %12.1f\n", name, append_ns, (unsigned long long)syncs,
+               (unsigned long long)(records / max<uint64_t>(syncs, 1)), total_ms);
+    }
+    unlink(path);
+}
+
+// Open connections to a running server all at once, the way clients
+// reconnect after a restart, and time how long each waits for its welcome
+// A connection whose SYN was dropped because the accept queue was full waits
+// for the SYN to be sent again, 1 s later, so those show up as the slow ones
+void bench_storm(int connections, int port)
+{
+    printf("storm: %d connections to port %d\n", connections, port);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof addr);
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    vector<struct pollfd> fds;
+    vector<uint64_t> started;
+    uint64_t start = now_ns();
+    for (int i = 0; i < connections; i++)
+    {
+        int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        if (fd == -1)
+        {
+            perror("socket");
+            break;
+        }
+        if (connect(fd, (struct sockaddr *)&addr, sizeof addr) == -1 && errno != EINPROGRESS)
+        {
+            perror("connect");
+            close(fd);
+            break;
+        }
+        fds.push_back({fd, POLLIN, 0});
+        started.push_back(now_ns());
+    }
+
+    // Wait for the welcome of every connection, for at most 10 s
+    vector<double> waits_ms;
+    vector<bool> done(fds.size(), false);
+    size_t failed = 0;
+    while (waits_ms.size() + failed < fds.size() && elapsed_ms(start) < 10000)
+    {
+        if (poll(fds.data(), fds.size(), 100) <= 0)
+        {
+            continue;
+        }
+        for (size_t i = 0; i < fds.size(); i++)
+        {
+            if (done[i] || fds[i].revents == 0)
+            {
+                continue;
+            }
+            char welcome[64];
+            if (recv(fds[i].fd, welcome, sizeof welcome, 0) > 0)
+            {
+                waits_ms.push_back((now_ns() - started[i]) / 1e6);
+            }
+            else
+            {
+                failed++;
+            }
+            done[i] = true;
+            fds[i].events = 0;
+        }
+    }
+    double total_ms = elapsed_ms(start);
+    for (struct pollfd &pfd : fds)
+    {
+        close(pfd.fd);
+    }
+    if (waits_ms.empty())
+    {
+        printf("  no connection was welcomed\n");
+        return;
+    }
+
+    sort(waits_ms.begin(), waits_ms.end());
+    size_t slow = waits_ms.end() - lower_bound(waits_ms.begin(), waits_ms.end(), 1000.0);
+    printf("  %10s %10s %10s %10s %10s %10s %10s\n", "welcomed", "lost", "p50 ms", "p99 ms", "max ms", ">= 1 s", "total ms");
+    printf("  %10zu %10zu %10.2f %10.2f %10.2f %10zu %10.1f\n", waits_ms.size(), fds.size() - waits_ms.size(),
+           waits_ms[waits_ms.size() / 2], waits_ms[waits_ms.size() * 99 / 100], waits_ms.back(), slow, total_ms);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc > 1 && strcmp(argv[1], "storm") == 0)
+    {
+        bench_storm(argc > 2 ? atoi(argv[2]) : 2000, argc > 3 ? atoi(argv[3]) : 9034);
+        return 0;
+    }
+    int vertices = argc > 1 ? atoi(argv[1]) : 1000000;
+    int degree = argc > 2 ? atoi(argv[2]) : 4;
+    if (vertices < 1 || degree < 1)
+    {
+        fprintf(stderr, "Usage: %s [vertices] [edges per vertex]\n", argv[0]);
+        return 1;
+    }
+    mt19937 rng(12345);
+    vector<pair<int, int>> edges = make_scrambled_graph(vertices, degree, rng);
+    bench_reorder(vertices, edges);
+    bench_storage(vertices, edges);
+    bench_kernels(vertices, degree, rng);
+    bench_queries(vertices, edges);
+    bench_traversal(vertices, edges, rng);
+    bench_huge_pages(vertices, edges);
+    bench_ids(vertices, rng);
+    bench_parser(vertices, rng);
+    bench_wal(vertices);
+    return 0;
+}
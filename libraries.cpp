@@ -3,10 +3,26 @@
 
 #include <iostream>
 #include <sys/select.h>
+#include <time.h>
 #include <unistd.h>
 #include <map>
 #include <vector>
 #include <pthread.h>
+#include <errno.h>
+#include <atomic>
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/eventfd.h>
+#include <deque>
+#include <functional>
+#include <string>
+#include <streambuf>
+#include <algorithm>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include "Affinity.cpp"
 
 // Abstract base class for event handlers
 class EventHandler
@@ -16,18 +32,270 @@ public:
     virtual void handle_event() = 0;
 };
 
+// Intrusive entry of a TimingWheel; embed it (or derive from it) to time an object
+struct TimerNode
+{
+    TimerNode *prev = nullptr; // Neighbors in the slot's list, null while not scheduled
+    TimerNode *next = nullptr;
+    uint64_t deadline = 0;     // Tick at which it expires
+
+    bool scheduled() const { return prev != nullptr; }
+};
+
+// Hierarchical timing wheel: TIMER_LEVELS wheels of 64 slots, each slot of a
+// wheel covering a whole turn of the wheel below, so adding and cancelling a
+// timer cost O(1) whatever the number of timers, and a timer is only touched
+// again when its slot of a higher wheel comes round and it moves down a level
+// Ticks are whatever unit the caller counts time in (the server uses ms)
+class TimingWheel
+{
+public:
+    static const int LEVELS = 4;    // 64^4 ticks ahead: 4.6 hours in ms
+    static const int SLOT_BITS = 6; // 64 slots per level
+    static const uint64_t SLOTS = 1ULL << SLOT_BITS;
+
+private:
+    TimerNode heads[LEVELS][SLOTS]; // Sentinels of the circular slot lists
+    uint64_t current;               // Last tick advance() reached
+    size_t count = 0;               // Timers scheduled
+
+    static void unlink(TimerNode *node)
+    {
+        node->prev->next = node->next;
+        node->next->prev = node->prev;
+        node->prev = node->next = nullptr;
+    }
+
+    // Put a node in the slot of the lowest wheel whose turn reaches its deadline
+    void insert(TimerNode *node)
+    {
+        uint64_t horizon = (1ULL << (SLOT_BITS * LEVELS)) - 1;
+        uint64_t deadline = std::min(node->deadline, current + horizon);
+        uint64_t delta = deadline > current ? deadline - current : 0;
+        int level = 0;
+        while (level < LEVELS - 1 && delta >= (1ULL << (SLOT_BITS * (level + 1))))
+        {
+            level++;
+        }
+        TimerNode *head = &heads[level][(deadline >> (SLOT_BITS * level)) & (SLOTS - 1)];
+        node->next = head;
+        node->prev = head->prev;
+        head->prev->next = node;
+        head->prev = node;
+    }
+
+    // Move the nodes of a slot to a local list, so they can be re-inserted or expired
+    void take(TimerNode *head, TimerNode &list)
+    {
+        list.next = list.prev = &list;
+        if (head->next != head)
+        {
+            list.next = head->next;
+            list.prev = head->prev;
+            list.next->prev = &list;
+            list.prev->next = &list;
+            head->next = head->prev = head;
+        }
+    }
+
+public:
+    explicit TimingWheel(uint64_t now) : current(now)
+    {
+        for (auto &level : heads)
+        {
+            for (TimerNode &head : level)
+            {
+                head.next = head.prev = &head;
+            }
+        }
+    }
+
+    TimingWheel(const TimingWheel &) = delete;
+    void operator=(const TimingWheel &) = delete;
+
+    // Schedule (or reschedule) a node to expire at a tick; a deadline that has
+    // passed expires at the next tick
+    void schedule(TimerNode *node, uint64_t deadline)
+    {
+        if (node->scheduled())
+        {
+            unlink(node);
+            count--;
+        }
+        node->deadline = std::max(deadline, current + 1);
+        insert(node);
+        count++;
+    }
+
+    // Unschedule a node; nothing happens if it is not scheduled
+    void cancel(TimerNode *node)
+    {
+        if (node->scheduled())
+        {
+            unlink(node);
+            count--;
+        }
+    }
+
+    // Move time forward to now, calling on_expire(node) for every node whose
+    // deadline passed; on_expire may schedule it (or any other node) again
+    template <typename Func>
+    void advance(uint64_t now, Func on_expire)
+    {
+        if (count == 0)
+        {
+            current = std::max(current, now);
+            return;
+        }
+        while (current < now)
+        {
+            current++;
+            // Where the lower wheels completed a turn, move the next slot of the
+            // higher ones down, starting from the highest
+            int top = 0;
+            while (top < LEVELS - 1 && (current & ((1ULL << (SLOT_BITS * (top + 1))) - 1)) == 0)
+            {
+                top++;
+            }
+            for (int level = top; level > 0; level--)
+            {
+                TimerNode list;
+                take(&heads[level][(current >> (SLOT_BITS * level)) & (SLOTS - 1)], list);
+                while (list.next != &list)
+                {
+                    TimerNode *node = list.next;
+                    unlink(node);
+                    insert(node);
+                }
+            }
+            TimerNode list;
+            take(&heads[0][current & (SLOTS - 1)], list);
+            while (list.next != &list)
+            {
+                TimerNode *node = list.next;
+                unlink(node);
+                if (node->deadline > current)
+                {
+                    insert(node); // Beyond the last wheel when it was scheduled
+                    continue;
+                }
+                count--;
+                on_expire(node);
+            }
+        }
+    }
+
+    // The first tick at which advance() may have work to do: the next tick of
+    // a timer of the lowest wheel or the next turn of it, whichever is first
+    // Returns UINT64_MAX if no timer is scheduled
+    uint64_t nextWakeup() const
+    {
+        if (count == 0)
+        {
+            return UINT64_MAX;
+        }
+        for (uint64_t tick = current + 1;; tick++)
+        {
+            const TimerNode &head = heads[0][tick & (SLOTS - 1)];
+            if (head.next != &head || (tick & (SLOTS - 1)) == 0)
+            {
+                return tick;
+            }
+        }
+    }
+
+    // Number of timers scheduled
+    size_t size() const { return count; }
+};
+
 // Reactor class for handling I/O events using the Reactor pattern
+// Besides file descriptors it runs timers: a handler schedules a callback with
+// scheduleAfter() and the loop calls it from its own thread once the delay is
+// over, so timeouts, heartbeats and batching need no thread of their own
 class Reactor
 {
+public:
+    // Handle of a scheduled callback, 0 is never one
+    using TimerId = uint64_t;
+
 private:
+    // A callback waiting on the timing wheel
+    // The objects are recycled; generation tells a stale TimerId from the
+    // handle of the callback that now uses the object
+    struct Timer : TimerNode
+    {
+        std::function<void()> callback; // What to run once the delay is over
+        uint32_t index = 0;             // Position in timers
+        uint32_t generation = 1;        // Bumped every time the object is freed, never 0
+    };
+
     std::map<int, EventHandler *> handlers; // Map of file descriptors to their corresponding event handlers
+    std::map<int, EventHandler *> write_handlers; // Handlers of the file descriptors monitored for writing
     fd_set read_fds; // Set of file descriptors to monitor for reading
     fd_set write_fds; // Set of file descriptors to monitor for writing
     bool running; // Flag to control the reactor loop
+    TimingWheel wheel; // Scheduled callbacks, in ms
+    std::deque<Timer> timers; // Every Timer object (a deque never moves them)
+    std::vector<uint32_t> free_timers; // Indexes of the Timer objects not in use
+
+    static uint64_t nowMs()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+    }
+
+    // The Timer of a handle, or null if it already ran or was cancelled
+    Timer *findTimer(TimerId id)
+    {
+        uint32_t index = (uint32_t)id;
+        if (id == 0 || index >= timers.size() || timers[index].generation != (uint32_t)(id >> 32))
+        {
+            return nullptr;
+        }
+        return &timers[index];
+    }
+
+    // The handle of a Timer
+    static TimerId timerId(const Timer *timer)
+    {
+        return ((TimerId)timer->generation << 32) | timer->index;
+    }
+
+    // Give a Timer object back, which makes its handle stale
+    void freeTimer(Timer *timer)
+    {
+        timer->callback = nullptr;
+        if (++timer->generation == 0)
+        {
+            timer->generation = 1;
+        }
+        free_timers.push_back(timer->index);
+    }
+
+    // Run the callbacks whose delay is over
+    void runTimers()
+    {
+        std::vector<TimerId> expired;
+        wheel.advance(nowMs(), [&](TimerNode *node)
+                      { expired.push_back(timerId(static_cast<Timer *>(node))); });
+        for (TimerId id : expired)
+        {
+            // An earlier callback of this round may have cancelled it
+            Timer *timer = findTimer(id);
+            if (timer == nullptr)
+            {
+                continue;
+            }
+            std::function<void()> callback = std::move(timer->callback);
+            freeTimer(timer);
+            callback();
+        }
+    }
 
 public:
     // Constructor to initialize the Reactor
-    Reactor()
+    Reactor() : wheel(nowMs())
     {
         FD_ZERO(&read_fds); // Initialize the read file descriptor set
         FD_ZERO(&write_fds); // Initialize the write file descriptor set
@@ -43,12 +311,13 @@ public:
         if (is_read)
         {
             FD_SET(fd, &read_fds); // Add to read file descriptor set
+            handlers[fd] = handler; // Add handler to the map
         }
         else
         {
             FD_SET(fd, &write_fds); // Add to write file descriptor set
+            write_handlers[fd] = handler; // Add handler to the map
         }
-        handlers[fd] = handler; // Add handler to the map
         return 0;
     }
 
@@ -59,9 +328,64 @@ public:
         FD_CLR(fd, &read_fds); // Remove from read file descriptor set
         FD_CLR(fd, &write_fds); // Remove from write file descriptor set
         handlers.erase(fd); // Remove handler from the map
+        write_handlers.erase(fd);
         return 0;
     }
 
+    // Stop monitoring a file descriptor for one kind of event
+    // fd: File descriptor to remove
+    // is_read: True to stop monitoring for read events, false for write events
+    int removeFdFromReactor(int fd, bool is_read)
+    {
+        if (is_read)
+        {
+            FD_CLR(fd, &read_fds);
+            handlers.erase(fd);
+        }
+        else
+        {
+            FD_CLR(fd, &write_fds);
+            write_handlers.erase(fd);
+        }
+        return 0;
+    }
+
+    // Call a function from the reactor loop once delay_ms have passed
+    // Returns the handle to cancel it with
+    TimerId scheduleAfter(uint64_t delay_ms, std::function<void()> callback)
+    {
+        uint32_t index;
+        if (free_timers.empty())
+        {
+            index = timers.size();
+            timers.emplace_back();
+            timers.back().index = index;
+        }
+        else
+        {
+            index = free_timers.back();
+            free_timers.pop_back();
+        }
+        Timer *timer = &timers[index];
+        timer->callback = std::move(callback);
+        wheel.schedule(timer, nowMs() + delay_ms);
+        return timerId(timer);
+    }
+
+    // Cancel a scheduled callback
+    // Returns false if it already ran or was cancelled
+    bool cancel(TimerId id)
+    {
+        Timer *timer = findTimer(id);
+        if (timer == nullptr)
+        {
+            return false;
+        }
+        wheel.cancel(timer);
+        freeTimer(timer);
+        return true;
+    }
+
     // Start the Reactor to begin handling events
     void startReactor()
     {
@@ -71,11 +395,28 @@ public:
             fd_set temp_read_fds = read_fds; // Temporary read file descriptor set for select()
             fd_set temp_write_fds = write_fds; // Temporary write file descriptor set for select()
 
+            // Wait no longer than until the next timer is due
+            struct timeval timeout;
+            struct timeval *timeout_ptr = nullptr;
+            uint64_t wakeup = wheel.nextWakeup();
+            if (wakeup != UINT64_MAX)
+            {
+                uint64_t now = nowMs();
+                uint64_t wait_ms = wakeup > now ? wakeup - now : 0;
+                timeout.tv_sec = wait_ms / 1000;
+                timeout.tv_usec = (wait_ms % 1000) * 1000;
+                timeout_ptr = &timeout;
+            }
+
             // Monitor file descriptors for events
-            int n = select(FD_SETSIZE, &temp_read_fds, &temp_write_fds, nullptr, nullptr);
+            int n = select(FD_SETSIZE, &temp_read_fds, &temp_write_fds, nullptr, timeout_ptr);
 
             if (n < 0)
             {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
                 perror("select error"); // Handle select error
                 break;
             }
@@ -83,15 +424,17 @@ public:
             // Check which file descriptors have events
             for (int fd = 0; fd < FD_SETSIZE; ++fd)
             {
-                if (FD_ISSET(fd, &temp_read_fds))
+                // A handler may have removed the descriptor earlier in this round
+                if (FD_ISSET(fd, &temp_read_fds) && handlers.count(fd))
                 {
                     handlers[fd]->handle_event(); // Handle read event
                 }
-                if (FD_ISSET(fd, &temp_write_fds))
+                if (FD_ISSET(fd, &temp_write_fds) && write_handlers.count(fd))
                 {
-                    handlers[fd]->handle_event(); // Handle write event
+                    write_handlers[fd]->handle_event(); // Handle write event
                 }
             }
+            runTimers();
         }
     }
 
@@ -111,32 +454,65 @@ public:
 
 private:
     // Structure to represent a task handled by the Proactor
+    // It lives on the heap until its thread is done, so the socket the
+    // function gets a pointer to stays valid for as long as it runs
     struct ProactorTask
     {
         int sockfd; // Socket file descriptor
         proactorFunc func; // Function to execute for the task
         pthread_t thread_id; // Thread ID for the task
+        Proactor *owner; // The Proactor that started it
     };
 
-    std::vector<ProactorTask> tasks; // Vector of tasks managed by the Proactor
+    pthread_mutex_t lock;                      // Protects tasks
+    std::map<pthread_t, ProactorTask *> tasks; // Tasks whose threads are running
+
+    // Forget a task once its thread is done, whether it returned or was cancelled
+    static void finish(void *arg)
+    {
+        ProactorTask *task = static_cast<ProactorTask *>(arg);
+        Proactor *owner = task->owner;
+        pthread_mutex_lock(&owner->lock);
+        owner->tasks.erase(task->thread_id);
+        pthread_mutex_unlock(&owner->lock);
+        delete task;
+    }
+
+    // Body of every task thread
+    static void *run(void *arg)
+    {
+        ProactorTask *task = static_cast<ProactorTask *>(arg);
+        void *result;
+        pthread_cleanup_push(finish, task);
+        result = task->func(&task->sockfd);
+        pthread_cleanup_pop(1);
+        return result;
+    }
 
 public:
+    Proactor() { pthread_mutex_init(&lock, NULL); }
+
     // Start a new task in the Proactor
     // sockfd: Socket file descriptor for the task
-    // threadFunc: Function to execute for the task
+    // threadFunc: Function to execute for the task, with a pointer to sockfd
     // Returns the thread ID of the created task
     pthread_t startProactor(int sockfd, proactorFunc threadFunc)
     {
-        ProactorTask task;
-        task.sockfd = sockfd;
-        task.func = threadFunc;
-        if (pthread_create(&task.thread_id, nullptr, threadFunc, &task.sockfd) != 0)
+        ProactorTask *task = new ProactorTask{sockfd, threadFunc, 0, this};
+        // The lock keeps the thread from forgetting its task before it is registered
+        pthread_mutex_lock(&lock);
+        if (pthread_create(&task->thread_id, nullptr, run, task) != 0)
         {
+            pthread_mutex_unlock(&lock);
             perror("pthread_create"); // Handle thread creation error
+            delete task;
             return -1;
         }
-        tasks.push_back(task); // Add task to the vector
-        return task.thread_id;
+        pthread_detach(task->thread_id);
+        pthread_t tid = task->thread_id;
+        tasks[tid] = task;
+        pthread_mutex_unlock(&lock);
+        return tid;
     }
 
     // Stop a running task in the Proactor
@@ -144,21 +520,506 @@ public:
     // Returns 0 on success, -1 on failure
     int stopProactor(pthread_t tid)
     {
-        for (auto it = tasks.begin(); it != tasks.end(); ++it)
+        pthread_mutex_lock(&lock);
+        int result = -1; // Task not found
+        if (tasks.count(tid))
+        {
+            result = pthread_cancel(tid) == 0 ? 0 : -1;
+            if (result == -1)
+            {
+                perror("pthread_cancel"); // Handle thread cancel error
+            }
+        }
+        pthread_mutex_unlock(&lock);
+        return result;
+    }
+
+    // Number of tasks whose threads are running
+    size_t taskCount()
+    {
+        pthread_mutex_lock(&lock);
+        size_t count = tasks.size();
+        pthread_mutex_unlock(&lock);
+        return count;
+    }
+};
+
+// Minimal io_uring, driven with the raw system calls (no liburing)
+// Operations are queued with push(), handed to the kernel with submit(), and
+// their completions read with pop(); the user_data of an operation comes back
+// with its completion
+class IoUring
+{
+private:
+    int ring_fd;                // The ring
+    unsigned sq_entries;        // Size of the submission queue
+    unsigned *sq_head;          // Submission queue, shared with the kernel
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned *cq_head;          // Completion queue, shared with the kernel
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+    void *sq_ring;              // The mappings
+    void *cq_ring;
+    size_t sq_ring_size;
+    size_t cq_ring_size;
+    unsigned unsubmitted = 0;   // Operations pushed since the last submit()
+
+public:
+    explicit IoUring(unsigned entries)
+    {
+        struct io_uring_params params;
+        memset(&params, 0, sizeof params);
+        ring_fd = syscall(__NR_io_uring_setup, entries, &params);
+        if (ring_fd == -1)
+        {
+            perror("io_uring_setup");
+            exit(1);
+        }
+        sq_entries = params.sq_entries;
+        sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+        bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (single_mmap)
+        {
+            sq_ring_size = cq_ring_size = std::max(sq_ring_size, cq_ring_size);
+        }
+        sq_ring = mmap(NULL, sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+        cq_ring = single_mmap ? sq_ring
+                              : mmap(NULL, cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+        sqes = (struct io_uring_sqe *)mmap(NULL, sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                                           MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+        if (sq_ring == MAP_FAILED || cq_ring == MAP_FAILED || sqes == MAP_FAILED)
+        {
+            perror("mmap");
+            exit(1);
+        }
+        char *sq = (char *)sq_ring;
+        sq_head = (unsigned *)(sq + params.sq_off.head);
+        sq_tail = (unsigned *)(sq + params.sq_off.tail);
+        sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+        sq_array = (unsigned *)(sq + params.sq_off.array);
+        char *cq = (char *)cq_ring;
+        cq_head = (unsigned *)(cq + params.cq_off.head);
+        cq_tail = (unsigned *)(cq + params.cq_off.tail);
+        cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+        cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    }
+
+    ~IoUring()
+    {
+        munmap(sqes, sq_entries * sizeof(struct io_uring_sqe));
+        if (cq_ring != sq_ring)
+        {
+            munmap(cq_ring, cq_ring_size);
+        }
+        munmap(sq_ring, sq_ring_size);
+        close(ring_fd);
+    }
+
+    IoUring(const IoUring &) = delete;
+    void operator=(const IoUring &) = delete;
+
+    // Queue an operation; the queue is submitted first if it is full
+    void push(const struct io_uring_sqe &sqe)
+    {
+        unsigned tail = *sq_tail;
+        if (tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) == sq_entries)
+        {
+            submit(0);
+        }
+        unsigned index = tail & *sq_mask;
+        sqes[index] = sqe;
+        sq_array[index] = index;
+        __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+        unsubmitted++;
+    }
+
+    // Hand the queued operations to the kernel and wait until at least
+    // wait_for of them completed
+    // Returns -1 on error (errno is EINTR if a signal interrupted the wait)
+    int submit(unsigned wait_for)
+    {
+        int n = syscall(__NR_io_uring_enter, ring_fd, unsubmitted, wait_for,
+                        wait_for > 0 ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+        if (n >= 0)
+        {
+            unsubmitted -= n;
+        }
+        return n < 0 ? -1 : 0;
+    }
+
+    // Take the next completion; returns false if there is none
+    bool pop(struct io_uring_cqe &cqe)
+    {
+        unsigned head = *cq_head;
+        if (head == __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE))
+        {
+            return false;
+        }
+        cqe = cqes[head & *cq_mask];
+        __atomic_store_n(cq_head, head + 1, __ATOMIC_RELEASE);
+        return true;
+    }
+};
+
+// Lock-free broadcast channel from a single publisher to a fixed set of subscribers
+// Events are kept in a ring of Capacity slots; every subscriber has its own
+// cursor and an eventfd it sleeps on, so it only wakes up when an event was
+// published. A subscriber that falls Capacity events behind skips the oldest ones.
+template <typename T, size_t Capacity>
+class EventChannel
+{
+public:
+    static const int MAX_SUBSCRIBERS = 8;
+
+private:
+    // A slot of the ring; seq is the number of the event it holds (0 while being written)
+    struct Slot
+    {
+        std::atomic<uint64_t> seq{0};
+        T value;
+    };
+
+    Slot slots[Capacity];                  // The ring of events
+    std::atomic<uint64_t> published{0};    // Number of events published so far
+    int wake_fds[MAX_SUBSCRIBERS];         // eventfd of every subscriber
+    std::atomic<int> subscriber_count{0};  // Number of subscribers
+
+public:
+    // A subscriber's view of the channel
+    class Subscription
+    {
+    private:
+        EventChannel *channel; // The channel
+        int wake_fd;           // Signalled by every publish
+        uint64_t next;         // Number of the next event to read (1 based)
+
+    public:
+        Subscription(EventChannel *channel, int wake_fd, uint64_t next)
+            : channel(channel), wake_fd(wake_fd), next(next) {}
+
+        // Wait for the next event and copy it to out
+        void wait(T &out)
         {
-            if (it->thread_id == tid)
+            while (!channel->try_read(next, out))
             {
-                if (pthread_cancel(tid) != 0)
+                uint64_t count;
+                if (read(wake_fd, &count, sizeof count) == -1 && errno != EINTR)
                 {
-                    perror("pthread_cancel"); // Handle thread cancel error
-                    return -1;
+                    perror("read(eventfd)");
                 }
-                tasks.erase(it); // Remove task from the vector
-                return 0;
             }
         }
-        return -1; // Task not found
+    };
+
+    // Register a subscriber; only events published afterwards are seen
+    Subscription subscribe()
+    {
+        int index = subscriber_count.load(std::memory_order_relaxed);
+        if (index == MAX_SUBSCRIBERS)
+        {
+            fprintf(stderr, "EventChannel: too many subscribers\n");
+            exit(1);
+        }
+        wake_fds[index] = eventfd(0, EFD_CLOEXEC);
+        subscriber_count.store(index + 1, std::memory_order_release);
+        return Subscription(this, wake_fds[index], published.load(std::memory_order_acquire) + 1);
+    }
+
+    // Publish an event (single publisher)
+    void publish(const T &value)
+    {
+        uint64_t seq = published.load(std::memory_order_relaxed) + 1;
+        Slot &slot = slots[seq % Capacity];
+        slot.seq.store(0, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        memcpy((void *)&slot.value, &value, sizeof(T));
+        slot.seq.store(seq, std::memory_order_release);
+        published.store(seq, std::memory_order_release);
+
+        uint64_t one = 1;
+        int count = subscriber_count.load(std::memory_order_acquire);
+        for (int i = 0; i < count; i++)
+        {
+            if (write(wake_fds[i], &one, sizeof one) == -1)
+            {
+                perror("write(eventfd)");
+            }
+        }
+    }
+
+private:
+    // Copy event number next to out and advance next
+    // Returns false if that event was not published yet
+    bool try_read(uint64_t &next, T &out)
+    {
+        while (true)
+        {
+            uint64_t last = published.load(std::memory_order_acquire);
+            if (next > last)
+            {
+                return false;
+            }
+            if (last - next >= Capacity)
+            {
+                next = last - Capacity + 1; // Overrun: skip the events that were overwritten
+            }
+            Slot &slot = slots[next % Capacity];
+            uint64_t before = slot.seq.load(std::memory_order_acquire);
+            memcpy((void *)&out, (const void *)&slot.value, sizeof(T));
+            std::atomic_thread_fence(std::memory_order_acquire);
+            uint64_t after = slot.seq.load(std::memory_order_relaxed);
+            if (before == next && after == next)
+            {
+                next++;
+                return true;
+            }
+            // The slot was reused while copying it; retry from the newest events
+        }
+    }
+};
+
+// Fixed set of worker threads that run queued tasks in order of submission
+// Used by the engine to run long queries off its command loop
+class ComputePool
+{
+private:
+    std::vector<pthread_t> workers;          // The worker threads
+    std::deque<std::function<void()>> tasks; // Tasks waiting for a worker
+    pthread_mutex_t lock;                    // Protects tasks and stopping
+    pthread_cond_t ready;                    // Signalled when a task is queued or the pool stops
+    bool stopping = false;                   // Set by the destructor
+
+    static void *worker_main(void *arg)
+    {
+        ComputePool *pool = static_cast<ComputePool *>(arg);
+        while (true)
+        {
+            pthread_mutex_lock(&pool->lock);
+            while (pool->tasks.empty() && !pool->stopping)
+            {
+                pthread_cond_wait(&pool->ready, &pool->lock);
+            }
+            if (pool->tasks.empty())
+            {
+                pthread_mutex_unlock(&pool->lock);
+                return nullptr;
+            }
+            std::function<void()> task = std::move(pool->tasks.front());
+            pool->tasks.pop_front();
+            pthread_mutex_unlock(&pool->lock);
+            task();
+        }
+    }
+
+public:
+    // With cpus, worker i only runs on cpus[i % cpus.size()]
+    explicit ComputePool(int threads, const std::vector<int> &cpus = {})
+    {
+        pthread_mutex_init(&lock, NULL);
+        pthread_cond_init(&ready, NULL);
+        for (int i = 0; i < threads; i++)
+        {
+            pthread_t thread;
+            if (pthread_create(&thread, nullptr, worker_main, this) != 0)
+            {
+                perror("pthread_create");
+                continue;
+            }
+            if (!cpus.empty())
+            {
+                pin_thread(thread, {cpus[i % cpus.size()]});
+            }
+            workers.push_back(thread);
+        }
+    }
+
+    // Runs the tasks still queued, then joins the workers
+    ~ComputePool()
+    {
+        pthread_mutex_lock(&lock);
+        stopping = true;
+        pthread_cond_broadcast(&ready);
+        pthread_mutex_unlock(&lock);
+        for (pthread_t thread : workers)
+        {
+            pthread_join(thread, nullptr);
+        }
+        pthread_cond_destroy(&ready);
+        pthread_mutex_destroy(&lock);
+    }
+
+    ComputePool(const ComputePool &) = delete;
+    void operator=(const ComputePool &) = delete;
+
+    void submit(std::function<void()> task)
+    {
+        pthread_mutex_lock(&lock);
+        tasks.push_back(std::move(task));
+        pthread_cond_signal(&ready);
+        pthread_mutex_unlock(&lock);
+    }
+};
+
+// Output stream handed from a producer thread to a consumer in chunks
+// The producer writes through a std::ostream on top of it; the text is cut
+// into chunks at line ends, and at most max_chunks of them wait for the
+// consumer: a producer that gets that far ahead sleeps until the consumer
+// takes one, so the memory used stays bounded whatever the output size
+// The first chunk is small and the chunks double up to max_chunk bytes, so
+// the first lines reach the consumer right away
+// wake_fd (an eventfd) is signalled for every chunk and at the end
+class ChunkStream : public std::streambuf
+{
+private:
+    pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER; // Protects chunks, closed and aborted
+    pthread_cond_t taken = PTHREAD_COND_INITIALIZER;  // Signalled when the consumer takes a chunk or aborts
+    std::deque<std::string> chunks; // Chunks ready for the consumer
+    size_t max_chunks;              // Chunks that may wait
+    size_t max_chunk;               // Largest chunk, in bytes
+    size_t limit;                   // Size of the next chunk
+    bool closed = false;            // Set by the producer after the last chunk
+    std::atomic<bool> aborted{false}; // Set by the consumer; the rest of the output is dropped
+    int wake_fd;                    // Signalled for every chunk
+    std::string current;            // Text not cut into a chunk yet (producer only)
+    char area[4096];                // Put area of the stream
+
+    void wake()
+    {
+        uint64_t one = 1;
+        if (write(wake_fd, &one, sizeof one) == -1)
+        {
+            perror("write");
+        }
+    }
+
+    // Hand a chunk to the consumer, waiting while too many are waiting
+    void push(std::string &&chunk)
+    {
+        pthread_mutex_lock(&lock);
+        while (chunks.size() >= max_chunks && !aborted.load(std::memory_order_relaxed))
+        {
+            pthread_cond_wait(&taken, &lock);
+        }
+        if (!aborted.load(std::memory_order_relaxed))
+        {
+            chunks.push_back(std::move(chunk));
+        }
+        pthread_mutex_unlock(&lock);
+        wake();
+    }
+
+    // Move the put area into current and cut the complete chunks off it
+    // The put area is never larger than the next chunk, so the small first
+    // chunks leave as soon as they are written
+    void drain()
+    {
+        current.append(pbase(), pptr() - pbase());
+        setp(area, area + std::min(sizeof area, limit));
+        if (aborted.load(std::memory_order_relaxed))
+        {
+            current.clear();
+            return;
+        }
+        while (current.size() >= limit)
+        {
+            size_t end = current.rfind('\n');
+            if (end == std::string::npos)
+            {
+                return; // A very long line: wait for its end
+            }
+            std::string chunk = current.substr(0, end + 1);
+            current.erase(0, end + 1);
+            push(std::move(chunk));
+            limit = std::min(limit * 2, max_chunk);
+        }
+    }
+
+protected:
+    int overflow(int c) override
+    {
+        drain();
+        if (c != traits_type::eof())
+        {
+            *pptr() = (char)c;
+            pbump(1);
+        }
+        return traits_type::not_eof(c);
+    }
+
+    int sync() override
+    {
+        drain();
+        return 0;
+    }
+
+public:
+    ChunkStream(int wake_fd, size_t max_chunk, size_t max_chunks)
+        : max_chunks(max_chunks), max_chunk(max_chunk), limit(std::min<size_t>(256, max_chunk)), wake_fd(wake_fd)
+    {
+        setp(area, area + std::min(sizeof area, limit));
+    }
+
+    ~ChunkStream()
+    {
+        pthread_cond_destroy(&taken);
+        pthread_mutex_destroy(&lock);
+    }
+
+    // Producer: hand out the rest of the output and mark the end
+    void close()
+    {
+        drain();
+        if (!current.empty())
+        {
+            push(std::move(current));
+            current.clear();
+        }
+        pthread_mutex_lock(&lock);
+        closed = true;
+        pthread_mutex_unlock(&lock);
+        wake();
+    }
+
+    // Consumer: take the oldest chunk; returns false if none is waiting
+    bool pop(std::string &chunk)
+    {
+        pthread_mutex_lock(&lock);
+        bool got = !chunks.empty();
+        if (got)
+        {
+            chunk = std::move(chunks.front());
+            chunks.pop_front();
+            pthread_cond_signal(&taken);
+        }
+        pthread_mutex_unlock(&lock);
+        return got;
+    }
+
+    // Consumer: true once the producer closed the stream; the chunks still
+    // waiting are then the last ones
+    bool finished()
+    {
+        pthread_mutex_lock(&lock);
+        bool done = closed;
+        pthread_mutex_unlock(&lock);
+        return done;
+    }
+
+    // Consumer: drop what is waiting and whatever the producer writes next,
+    // waking a producer that waits for room
+    void abort()
+    {
+        pthread_mutex_lock(&lock);
+        aborted.store(true, std::memory_order_relaxed);
+        chunks.clear();
+        pthread_cond_broadcast(&taken);
+        pthread_mutex_unlock(&lock);
     }
 };
 
-#endif 
+#endif
@@ -1,70 +1,36 @@
 #include <iostream>
 #include <vector>
-#include <stack>
 #include <deque>
+#include "Adjacency.cpp"
+#include "SccKernel.cpp"
 
 using namespace std;
 
-void dfs(int v, vector<bool> &visited, stack<int> &Stack, vector<deque<int>> &adj)
-{
-    visited[v] = true;
-    for (auto i = adj[v].begin(); i != adj[v].end(); ++i)
-    {
-        if (!visited[*i])
-        {
-            dfs(*i, visited, Stack, adj);
-        }
-    }
-    Stack.push(v);
-}
-
-void reverseDfs(int v, vector<bool> &visited, vector<deque<int>> &revAdj, vector<int> &component)
-{
-    visited[v] = true;
-    component.push_back(v);
-    for (auto i = revAdj[v].begin(); i != revAdj[v].end(); ++i)
-    {
-        if (!visited[*i])
-        {
-            reverseDfs(*i, visited, revAdj, component);
-        }
-    }
-}
-
+// Find and print all the SCCs with the shared kernel over deque adjacency
 void kosaraju(int vertices, vector<pair<int, int>> &edges)
 {
-    vector<deque<int>> adj(vertices);
-    vector<deque<int>> revAdj(vertices);
-    for (auto edge : edges)
-    {
-        adj[edge.first - 1].push_back(edge.second - 1);
-        revAdj[edge.second - 1].push_back(edge.first - 1);
-    }
-    stack<int> Stack;
-    vector<bool> visited(vertices, false);
+    DequeAdjacency adj, revAdj;
+    adj.clear(vertices);
+    revAdj.clear(vertices);
     for (int i = 0; i < vertices; i++)
     {
-        if (!visited[i])
-        {
-            dfs(i, visited, Stack, adj);
-        }
+        adj.addVertex();
+        revAdj.addVertex();
     }
-    fill(visited.begin(), visited.end(), false);
-    while (!Stack.empty())
+    for (auto edge : edges)
     {
-        int v = Stack.top();
-        Stack.pop();
-
-        if (!visited[v])
-        {
-            vector<int> component;
-            reverseDfs(v, visited, revAdj, component);
-            cout << "SCC:";
-            for (int vertex : component)
-                cout << " " << (vertex + 1);
-            cout << endl;
-        }
+        adj.add(edge.first - 1, edge.second - 1);
+        revAdj.add(edge.second - 1, edge.first - 1);
     }
+    SccResult result;
+    scc_run(adj, revAdj, vertices, [](const auto &component)
+            {
+                cout << "SCC:";
+                for (auto vertex : component)
+                    cout << " " << (vertex + 1);
+                cout << endl;
+            },
+            result);
 }
 
 int main()
@@ -6,83 +6,998 @@
 #include <algorithm>
 #include <list>
 #include <limits>
+#include <string.h>
+#include <string_view>
+#include <limits.h>
+#include <errno.h>
+#include <map>
+#include <set>
+#include <memory>
+#include <thread>
+#include <poll.h>
+#include <getopt.h>
+#include <sys/eventfd.h>
 #include "Graph.cpp"
+#include "CommandParser.cpp"
+#include "Protocol.cpp"
+#include "Metrics.cpp"
+#include "libraries.cpp"
+#include "Wal.cpp"
 using namespace std;
 
-int main()
+int pending_edges = 0; // Number of edges still expected after a Newgraph command
+
+string pending_notes;      // Notifications to publish after the current command
+SccEvent last_summary;     // SCC summary published last
+bool have_summary = false; // True once a summary was published
+
+// Publish a notification when a K changed the SCC summary of the graph:
+// the largest SCC crossed 50% of the vertices or the number of SCCs changed
+void publish_scc_summary(Graph *graph)
 {
-    Graph *graph = Graph::getInstance(); // Get the singleton instance of the Graph
-    while (true)
+    SccEvent event;
+    event.largest = graph->get_max_scc();
+    event.components = graph->get_scc_count();
+    event.vertices = graph->getVertexCount();
+    event.majority = (event.largest >= (event.vertices / 2) + 1);
+    bool prev_majority = have_summary && last_summary.majority;
+    event.majority_changed = (event.majority != prev_majority);
+    if (have_summary && !event.majority_changed && event.components == last_summary.components)
     {
-        cout << "Enter the action that you want to perform:" << endl;
-        string input;
-        getline(cin, input); // Get user input
-        istringstream iss(input);
-        string action, params;
-        iss >> action; // Extract the action command
-        getline(iss, params); // Extract the parameters
-        params.erase(remove(params.begin(), params.end(), ' '), params.end()); // Remove spaces from parameters
+        return;
+    }
+    last_summary = event;
+    have_summary = true;
+    pending_notes += format_scc_note(event);
+}
+
+#define SCC_CHUNK_BYTES (16 * 1024) // Largest piece of a K's listing sent in one frame
+#define SCC_STREAM_CHUNKS 8         // Pieces a K may compute ahead of its client
+
+// A K, Topo, HasCycle, BFS or Reach running on the compute pool
+struct SccJob
+{
+    uint64_t id;            // Number shown to the clients
+    RequestTag tag;         // Request that started it
+    uint64_t start_ns;      // When it started
+    size_t total;           // Progress value of a finished run (2 * vertices for K and Topo, vertices for the others)
+    SccControl control;     // Progress and cancellation
+    ChunkStream stream;     // The listing, handed to the loop as it is found
+    CommandVerb verb;       // The command it performs
+    SccQuery query;         // What a K asked for
+    VertexId from, to;      // The vertices of a BFS or Reach
+    SccResult result;       // Summary of the run, if it finished
+    bool finished = false;  // True if it ran to the end, false if it was cancelled
+
+    explicit SccJob(int wake_fd) : stream(wake_fd, SCC_CHUNK_BYTES, SCC_STREAM_CHUNKS) {}
+};
+
+// The jobs of the engine
+// Only the command loop touches the table; the pool threads hand the listing
+// over through the streams of the jobs and wake the loop with wake_fd
+struct JobTable
+{
+    uint64_t next_id = 1;                         // Number of the next job
+    map<uint64_t, shared_ptr<SccJob>> running;    // Jobs started and not reported yet
+    set<uint64_t> paused;                         // Connections whose output backed up in the server
+    int wake_fd = -1;                             // eventfd signalled for every piece of output
+    uint64_t started = 0;                         // Jobs started since startup
+    uint64_t cancelled = 0;                       // Jobs that were cancelled
+    uint64_t chunks = 0;                          // Pieces of listings streamed
+} jobs;
+
+// Stop a job: the run ends at its next checkpoint and the rest of its
+// listing is dropped
+void cancel_job(SccJob &job)
+{
+    job.control.cancelled.store(true, memory_order_relaxed);
+    job.stream.abort();
+}
+
+// Statistics of the engine, printed by the Stats command
+struct EngineStats
+{
+    uint64_t commands = 0;     // Command lines performed
+    uint64_t scc_runs = 0;     // Number of K commands
+    uint64_t scc_last_us = 0;  // Duration of the last K
+    uint64_t scc_total_us = 0; // Duration of all the K commands
+    LatencyHistogram scc_us;   // Distribution of the K durations
+} engine_stats;
+
+WriteAheadLog wal; // Log of the commands that changed the graph, if enabled
+
+// Print the engine's statistics
+void print_stats(Graph *graph, ostream &out)
+{
+    out << "engine_graph_vertices " << graph->getVertexCount() << '\n';
+    out << "engine_graph_edges " << graph->getEdgeCount() << '\n';
+    out << "engine_graph_adjacency_bytes " << graph->getAdjacencyBytes() << '\n';
+    out << "engine_huge_page_explicit_bytes " << huge_pages().explicit_bytes.load() << '\n';
+    out << "engine_huge_page_advised_bytes " << huge_pages().advised_bytes.load() << '\n';
+    out << "engine_storage_mode{mode=\"" << storage_mode_name(graph->getStorageMode()) << "\"} 1" << '\n';
+    out << "engine_reorder_mode{mode=\"" << reorder_mode_name(graph->getReorderMode()) << "\"} 1" << '\n';
+    out << "engine_commands " << engine_stats.commands << '\n';
+    out << "engine_jobs_running " << jobs.running.size() << '\n';
+    out << "engine_jobs_started " << jobs.started << '\n';
+    out << "engine_jobs_cancelled " << jobs.cancelled << '\n';
+    out << "engine_stream_chunks " << jobs.chunks << '\n';
+    out << "engine_streams_paused " << jobs.paused.size() << '\n';
+    out << "engine_scc_runs " << engine_stats.scc_runs << '\n';
+    out << "engine_scc_last_us " << engine_stats.scc_last_us << '\n';
+    out << "engine_scc_total_us " << engine_stats.scc_total_us << '\n';
+    out << "engine_scc_us p50=" << engine_stats.scc_us.percentile(0.5)
+        << " p99=" << engine_stats.scc_us.percentile(0.99)
+        << " max=" << engine_stats.scc_us.largest() << '\n';
+    if (wal.enabled())
+    {
+        out << "engine_wal_records " << wal.records.get() << '\n';
+        out << "engine_wal_bytes " << wal.bytes.get() << '\n';
+        out << "engine_wal_syncs " << wal.syncs.get() << '\n';
+        out << "engine_wal_checkpoints " << wal.checkpoints.get() << '\n';
+        out << "engine_wal_sync_us p50=" << wal.sync_us.percentile(0.5)
+            << " p99=" << wal.sync_us.percentile(0.99)
+            << " max=" << wal.sync_us.largest() << '\n';
+    }
+}
+
+// Parse "a,b" (or "a b") into two non-negative integers
+bool parse_pair(string_view params, int &a, int &b)
+{
+    uint64_t first, second;
+    if (!scan_pair(params, first, second) || first > INT_MAX || second > INT_MAX)
+    {
+        return false;
+    }
+    a = first;
+    b = second;
+    return true;
+}
+
+// Parse "u,v" (or "u v") into two vertex numbers
+bool parse_edge(string_view params, VertexId &u, VertexId &v)
+{
+    return scan_pair(params, u, v);
+}
+
+#define K_USAGE "Invalid parameters for K. Please use 'K', 'K count', 'K top N' or 'K histogram', " \
+                "optionally followed by 'from v' or 'subset v1,v2,...'."
+#define TOPO_USAGE "Invalid parameters for Topo. Please use 'Topo' without parameters."
+#define HASCYCLE_USAGE "Invalid parameters for HasCycle. Please use 'HasCycle' without parameters."
+#define BFS_USAGE "Invalid parameters for BFS. Please use the format 'BFS v'."
+#define REACH_USAGE "Invalid parameters for Reach. Please use the format 'Reach u,v'."
+
+// True for the commands that only read the graph and run as jobs in the
+// framed mode
+bool runs_as_job(CommandVerb verb)
+{
+    return verb == VERB_K || verb == VERB_TOPO || verb == VERB_HASCYCLE || verb == VERB_BFS || verb == VERB_REACH;
+}
+
+// True if the parameters hold nothing but spaces
+bool no_params(string_view params)
+{
+    return params.find_first_not_of(' ') == string_view::npos;
+}
 
-        if (action == "Newgraph")
+// Perform a single command line, writing its response to out
+// Returns false when the program should exit
+bool handle_line(Graph *graph, string_view input, ostream &out)
+{
+    engine_stats.commands++;
+    if (pending_edges > 0)
+    {
+        // Edge lines that follow a Newgraph command
+        VertexId u, v;
+        if (!parse_edge(input, u, v))
+        {
+            out << "Invalid edge. Please use the format 'u v'." << '\n';
+            return true;
+        }
+        graph->newEdge(u, v, out);
+        if (--pending_edges == 0)
         {
-            size_t commaPos = params.find(',');
-            if (commaPos != string::npos)
+            out << "The graph was created successfully" << '\n';
+        }
+        return true;
+    }
+
+    Command command = parse_command(input);
+    if (command.verb == VERB_NEWGRAPH)
+    {
+        // Parse the number of vertices and edges
+        int vertices, edges;
+        if (parse_pair(command.params, vertices, edges))
+        {
+            graph->newGraph(vertices, edges, out); // Create a new graph
+            pending_edges = edges;
+        }
+        else
+        {
+            out << "Invalid parameters for Newgraph. Please use the format 'Newgraph vertices,edges'." << '\n';
+        }
+    }
+    else if (command.verb == VERB_K)
+    {
+        // Perform Kosaraju's algorithm to find SCCs
+        SccQuery query;
+        if (!parse_scc_query(string(command.params), query))
+        {
+            out << K_USAGE << '\n';
+            return true;
+        }
+        uint64_t start = now_ns();
+        graph->kosaraju(out, query);
+        engine_stats.scc_last_us = (now_ns() - start) / 1000;
+        engine_stats.scc_total_us += engine_stats.scc_last_us;
+        engine_stats.scc_runs++;
+        engine_stats.scc_us.record(engine_stats.scc_last_us);
+        if (query.region == SCC_WHOLE)
+        {
+            publish_scc_summary(graph);
+        }
+    }
+    else if (command.verb == VERB_JOBS)
+    {
+        // List the jobs that are running
+        if (jobs.running.empty())
+        {
+            out << "No jobs are running" << '\n';
+        }
+        for (const auto &entry : jobs.running)
+        {
+            const SccJob &job = *entry.second;
+            size_t done = job.control.progress.load(memory_order_relaxed);
+            out << "Job " << job.id << " (request " << job.tag.seq << " of connection " << job.tag.conn << "): "
+                << (job.total == 0 ? 0 : done * 100 / job.total) << "% done, running for "
+                << (now_ns() - job.start_ns) / 1000000 << " ms"
+                << (job.control.cancelled.load(memory_order_relaxed) ? ", cancelling" : "")
+                << (jobs.paused.count(job.tag.conn) ? ", waiting for its client" : "") << '\n';
+        }
+    }
+    else if (command.verb == VERB_CANCEL)
+    {
+        // Stop a K job; its request is answered as soon as it stopped
+        VertexId id;
+        auto it = scan_number(command.params, id) ? jobs.running.find(id) : jobs.running.end();
+        if (it != jobs.running.end())
+        {
+            cancel_job(*it->second);
+            out << "Cancelling job " << id << '\n';
+        }
+        else
+        {
+            out << "No job " << without_spaces(command.params) << " is running" << '\n';
+        }
+    }
+    else if (command.verb == VERB_STATS)
+    {
+        // Print the runtime statistics
+        print_stats(graph, out);
+    }
+    else if (command.verb == VERB_REORDER)
+    {
+        // Choose how the vertices are relabeled before K
+        ReorderMode mode;
+        string params = without_spaces(command.params);
+        if (params.empty())
+        {
+            out << "Reorder mode: " << reorder_mode_name(graph->getReorderMode()) << '\n';
+        }
+        else if (parse_reorder_mode(params, mode))
+        {
+            graph->setReorderMode(mode);
+            out << "Reorder mode set to " << reorder_mode_name(mode) << '\n';
+        }
+        else
+        {
+            out << "Invalid parameters for Reorder. Please use 'Reorder none', 'Reorder bfs' or 'Reorder degree'." << '\n';
+        }
+    }
+    else if (command.verb == VERB_STORAGE)
+    {
+        // Choose how the edges are stored
+        StorageMode mode;
+        string params = without_spaces(command.params);
+        if (params.empty())
+        {
+            out << "Storage mode: " << storage_mode_name(graph->getStorageMode()) << '\n';
+        }
+        else if (parse_storage_mode(params, mode))
+        {
+            graph->setStorageMode(mode);
+            out << "Storage mode set to " << storage_mode_name(mode) << '\n';
+        }
+        else
+        {
+            out << "Invalid parameters for Storage. Please use 'Storage list' or 'Storage compact'." << '\n';
+        }
+    }
+    else if (command.verb == VERB_TOPO)
+    {
+        // List the SCCs in topological order
+        if (no_params(command.params))
+        {
+            graph->prepareScc();
+            graph->topologicalOrder(out);
+        }
+        else
+        {
+            out << TOPO_USAGE << '\n';
+        }
+    }
+    else if (command.verb == VERB_HASCYCLE)
+    {
+        // Look for a cycle
+        if (no_params(command.params))
+        {
+            graph->prepareScc();
+            graph->hasCycle(out);
+        }
+        else
+        {
+            out << HASCYCLE_USAGE << '\n';
+        }
+    }
+    else if (command.verb == VERB_BFS)
+    {
+        // Parse the vertex to search from
+        VertexId source;
+        if (scan_number(command.params, source))
+        {
+            graph->prepareScc();
+            graph->bfs(source, out); // Print the distances from it
+        }
+        else
+        {
+            out << BFS_USAGE << '\n';
+        }
+    }
+    else if (command.verb == VERB_REACH)
+    {
+        // Parse the two vertices
+        VertexId u, v;
+        if (parse_edge(command.params, u, v))
+        {
+            graph->prepareScc();
+            graph->reach(u, v, out); // Tell whether v can be reached from u
+        }
+        else
+        {
+            out << REACH_USAGE << '\n';
+        }
+    }
+    else if (command.verb == VERB_NEWEDGE)
+    {
+        // Parse the vertices for the new edge
+        VertexId u, v;
+        if (parse_edge(command.params, u, v))
+        {
+            graph->newEdge(u, v, out); // Add a new edge to the graph
+        }
+        else
+        {
+            out << "Invalid parameters for Newedge. Please use the format 'Newedge u,v'." << '\n';
+        }
+    }
+    else if (command.verb == VERB_REMOVEEDGE)
+    {
+        // Parse the vertices for the edge to remove
+        VertexId u, v;
+        if (parse_edge(command.params, u, v))
+        {
+            graph->removeEdge(u, v, out); // Remove an edge from the graph
+        }
+        else
+        {
+            out << "Invalid parameters for Removeedge. Please use the format 'Removeedge u,v'." << '\n';
+        }
+    }
+    else if (command.verb == VERB_END)
+    {
+        // Exit the program
+        return false;
+    }
+    else
+    {
+        out << "Invalid action. Available actions: Newgraph, K, Newedge, Removeedge, Reorder, Storage, Topo, HasCycle, BFS, Reach, Jobs, Cancel, Stats, end." << '\n';
+    }
+    return true;
+}
+
+// Write a whole buffer to a file descriptor
+void write_all(int fd, const string &data)
+{
+    size_t written = 0;
+    while (written < data.size())
+    {
+        ssize_t n = write(fd, data.data() + written, data.size() - written);
+        if (n == -1)
+        {
+            perror("write");
+            exit(1);
+        }
+        written += n;
+    }
+}
+
+// Log a command that changes the graph before it is performed
+// Records are whole commands: the edge lines of a Newgraph are logged as
+// Newedge commands and the Newgraph itself without its edge count, so a log
+// cut short in the middle of a graph still replays into a consistent one
+// A valid Newgraph starts the log over, keeping the modes set before it
+void log_command(Graph *graph, string_view line)
+{
+    if (!wal.enabled())
+    {
+        return;
+    }
+    if (pending_edges > 0)
+    {
+        VertexId u, v;
+        if (parse_edge(line, u, v))
+        {
+            wal.append("Newedge " + to_string(u) + "," + to_string(v));
+        }
+        return;
+    }
+    // Only the commands that will change something are logged, and in the
+    // form the parser reads back, so a rejected command costs no sync
+    Command command = parse_command(line);
+    VertexId u, v;
+    if (command.verb == VERB_NEWEDGE || command.verb == VERB_REMOVEEDGE)
+    {
+        if (parse_edge(command.params, u, v) && (command.verb == VERB_NEWEDGE || graph->hasEdge(u, v)))
+        {
+            wal.append((command.verb == VERB_NEWEDGE ? "Newedge " : "Removeedge ") + to_string(u) + "," + to_string(v));
+        }
+        return;
+    }
+    ReorderMode reorder;
+    StorageMode storage;
+    string params = without_spaces(command.params);
+    if (command.verb == VERB_REORDER && parse_reorder_mode(params, reorder))
+    {
+        wal.append(string("Reorder ") + reorder_mode_name(reorder));
+        return;
+    }
+    if (command.verb == VERB_STORAGE && parse_storage_mode(params, storage))
+    {
+        wal.append(string("Storage ") + storage_mode_name(storage));
+        return;
+    }
+    if (command.verb != VERB_NEWGRAPH)
+    {
+        return;
+    }
+    int vertices, edges;
+    if (parse_pair(command.params, vertices, edges))
+    {
+        wal.reset(string("Storage ") + storage_mode_name(graph->getStorageMode()) + '\n' +
+                  "Reorder " + reorder_mode_name(graph->getReorderMode()) + '\n' +
+                  "Newgraph " + to_string(vertices) + ",0" + '\n');
+    }
+}
+
+#define WAL_CHECKPOINT_RATIO 4    // Records a log may hold per record of a snapshot of the graph
+#define WAL_CHECKPOINT_SLACK 4096 // Records a log may always hold
+
+// Replace the log with a snapshot of the graph once it holds
+// WAL_CHECKPOINT_RATIO times more records than the snapshot would; otherwise
+// a steady stream of Newedge and Removeedge grows the log, and the replay at
+// startup, without bound while the graph keeps its size
+// The snapshot is the modes, "Newgraph n,0" for the vertices 1..n, a Newedge
+// for every edge and, for every other vertex without edges, a self-loop added
+// and removed (the only way the commands add a lone vertex)
+// Called after a command was performed, so the snapshot covers every record
+// logged; never while a job reads the graph
+void checkpoint_log(Graph *graph)
+{
+    if (!wal.enabled() || !jobs.running.empty())
+    {
+        return;
+    }
+    uint64_t snapshot_records = (uint64_t)graph->getEdgeCount() + graph->getVertexCount() + 3;
+    if (wal.loggedCount() <= WAL_CHECKPOINT_RATIO * snapshot_records + WAL_CHECKPOINT_SLACK)
+    {
+        return;
+    }
+    VertexId first = 0;
+    while (graph->hasVertex(first + 1))
+    {
+        first++;
+    }
+    string snapshot = string("Storage ") + storage_mode_name(graph->getStorageMode()) + '\n' +
+                      "Reorder " + reorder_mode_name(graph->getReorderMode()) + '\n' +
+                      "Newgraph " + to_string(first) + ",0" + '\n';
+    graph->forEachVertex([&](VertexId id, size_t degree)
+                         {
+                             if (degree == 0 && id > first)
+                             {
+                                 snapshot += "Newedge " + to_string(id) + "," + to_string(id) + '\n';
+                                 snapshot += "Removeedge " + to_string(id) + "," + to_string(id) + '\n';
+                             }
+                         });
+    graph->forEachEdge([&](VertexId u, VertexId v)
+                       { snapshot += "Newedge " + to_string(u) + "," + to_string(v) + '\n'; });
+    wal.reset(snapshot);
+    wal.checkpoints.add();
+}
+
+// Append the frame of a response, followed by the notifications it caused
+void append_frame(string &frames, const RequestTag &tag, const string &payload, const char *flag)
+{
+    frames += format_frame_header(tag, payload.size(), flag);
+    frames += payload;
+    if (!pending_notes.empty())
+    {
+        RequestTag note_tag = {0, 0};
+        frames += format_frame_header(note_tag, pending_notes.size(), FRAME_NOTE);
+        frames += pending_notes;
+        pending_notes.clear();
+    }
+}
+
+// Start a K, Topo, HasCycle, BFS or Reach as a job on the pool
+// The request gets a "more" frame with the job number right away, the
+// listing in "more" frames as it is found, and its "end" frame once the job
+// finished or was cancelled
+void start_job(Graph *graph, ComputePool &pool, const RequestTag &tag, const Command &command, string &frames)
+{
+    shared_ptr<SccJob> job = make_shared<SccJob>(jobs.wake_fd);
+    const char *usage = nullptr;
+    if (command.verb == VERB_K && !parse_scc_query(string(command.params), job->query))
+    {
+        usage = K_USAGE;
+    }
+    else if (command.verb == VERB_TOPO && !no_params(command.params))
+    {
+        usage = TOPO_USAGE;
+    }
+    else if (command.verb == VERB_HASCYCLE && !no_params(command.params))
+    {
+        usage = HASCYCLE_USAGE;
+    }
+    else if (command.verb == VERB_BFS && !scan_number(command.params, job->from))
+    {
+        usage = BFS_USAGE;
+    }
+    else if (command.verb == VERB_REACH && !parse_edge(command.params, job->from, job->to))
+    {
+        usage = REACH_USAGE;
+    }
+    if (usage != nullptr)
+    {
+        append_frame(frames, tag, string(usage) + "\n", FRAME_END);
+        return;
+    }
+    // prepareScc() may relabel the graph or merge its logged changes, so it
+    // must not run under the jobs reading it. It only has to run when no job
+    // is running: the jobs start from a prepared graph, and while any of them
+    // runs every command that could change the graph is deferred (see
+    // run_framed), so the graph stays prepared until the last one ends
+    if (jobs.running.empty())
+    {
+        graph->prepareScc();
+    }
+    job->id = jobs.next_id++;
+    job->tag = tag;
+    job->verb = command.verb;
+    job->start_ns = now_ns();
+    if (command.verb == VERB_K)
+    {
+        job->total = 2 * (job->query.region == SCC_SUBSET ? job->query.vertices.size() : (size_t)graph->getVertexCount());
+    }
+    else
+    {
+        job->total = (command.verb == VERB_TOPO ? 2 : 1) * (size_t)graph->getVertexCount();
+    }
+    jobs.running[job->id] = job;
+    jobs.started++;
+    append_frame(frames, tag, "Job " + to_string(job->id) + " started\n", FRAME_MORE);
+    pool.submit([graph, job]()
+                {
+                    ostream out(&job->stream);
+                    if (job->verb == VERB_K)
+                    {
+                        job->finished = graph->querySccs(job->query, out, job->result, &job->control);
+                    }
+                    else if (job->verb == VERB_TOPO)
+                    {
+                        job->finished = graph->topologicalOrder(out, &job->control);
+                    }
+                    else if (job->verb == VERB_HASCYCLE)
+                    {
+                        job->finished = graph->hasCycle(out, &job->control);
+                    }
+                    else if (job->verb == VERB_BFS)
+                    {
+                        job->finished = graph->bfs(job->from, out, &job->control);
+                    }
+                    else
+                    {
+                        job->finished = graph->reach(job->from, job->to, out, &job->control);
+                    }
+                    out.flush();
+                    job->stream.close();
+                });
+}
+
+// Send the listings of the jobs as far as they got
+// A job whose client's output backed up in the server is skipped, so its
+// stream fills up and the job waits; a job that is done sends the rest of its
+// listing (at most SCC_STREAM_CHUNKS pieces) with its "end" frame
+void pump_jobs(Graph *graph, string &frames)
+{
+    string chunk;
+    for (auto it = jobs.running.begin(); it != jobs.running.end();)
+    {
+        SccJob &job = *it->second;
+        bool done = job.stream.finished(); // Before taking chunks, so none is missed
+        if (job.control.cancelled.load(memory_order_relaxed))
+        {
+            if (done)
+            {
+                jobs.cancelled++;
+                append_frame(frames, job.tag, "Job " + to_string(job.id) + " cancelled\n", FRAME_END);
+                it = jobs.running.erase(it);
+                continue;
+            }
+        }
+        else if (done)
+        {
+            string rest;
+            while (job.stream.pop(chunk))
+            {
+                rest += chunk;
+            }
+            if (job.verb == VERB_K)
+            {
+                engine_stats.scc_last_us = (now_ns() - job.start_ns) / 1000;
+                engine_stats.scc_total_us += engine_stats.scc_last_us;
+                engine_stats.scc_runs++;
+                engine_stats.scc_us.record(engine_stats.scc_last_us);
+            }
+            if (job.verb == VERB_K && job.query.region == SCC_WHOLE)
+            {
+                // Only a run over every vertex tells about the whole graph
+                graph->setSccResult(job.result);
+                publish_scc_summary(graph);
+            }
+            append_frame(frames, job.tag, rest, FRAME_END);
+            it = jobs.running.erase(it);
+            continue;
+        }
+        else if (!jobs.paused.count(job.tag.conn))
+        {
+            while (job.stream.pop(chunk))
+            {
+                jobs.chunks++;
+                append_frame(frames, job.tag, chunk, FRAME_MORE);
+            }
+        }
+        ++it;
+    }
+}
+
+// Cancel every job started by a connection
+void cancel_jobs_of(uint64_t conn)
+{
+    for (auto &entry : jobs.running)
+    {
+        if (entry.second->tag.conn == conn)
+        {
+            cancel_job(*entry.second);
+        }
+    }
+}
+
+// A command waiting for the jobs to finish
+struct DeferredCommand
+{
+    RequestTag tag;
+    string command;
+};
+
+// Frames waiting for the log records they answer to be on the disk
+struct HeldFrames
+{
+    uint64_t record; // Records appended when the frames were made
+    string frames;
+};
+
+// Run as the engine of a server: every input line carries a request tag and
+// every response is written back as a frame (see Protocol.cpp)
+// Pipelined commands are handled in batches: all the lines that arrived with
+// one read() are performed back to back and their frames leave with one write()
+// A K (or a Topo, HasCycle, BFS or Reach) runs as a job on a pool of threads while the
+// loop keeps answering. The jobs only read the graph, so the other commands
+// wait (in order, with everything after them) until no job is running; Jobs
+// and Cancel are always answered right away
+// The listing of a job is streamed to its client in bounded pieces while it
+// runs; the server sends "!pause <conn>" when the client's output backs up and
+// "!resume <conn>" once it caught up (see pump_jobs)
+// With a write-ahead log the frames of a batch leave once the records logged
+// before them are synced, so a response never reports a change a crash could
+// lose; the loop keeps reading commands while they wait
+void run_framed(Graph *graph, int threads, const vector<int> &job_cpus)
+{
+    ComputePool pool(threads, job_cpus);
+    char buf[65536];
+    LineAssembler lines;
+    ostringstream out;
+    string frames;
+    deque<DeferredCommand> deferred;
+    deque<HeldFrames> held;
+    bool running = true;
+
+    jobs.wake_fd = eventfd(0, EFD_CLOEXEC);
+    if (jobs.wake_fd == -1)
+    {
+        perror("eventfd");
+        exit(1);
+    }
+
+    // Perform a command now
+    auto perform = [&](const RequestTag &tag, string_view command)
+    {
+        Command parsed = parse_command(command);
+        if (pending_edges == 0 && runs_as_job(parsed.verb))
+        {
+            start_job(graph, pool, tag, parsed, frames);
+            return;
+        }
+        log_command(graph, command);
+        out.str("");
+        running = handle_line(graph, command, out);
+        checkpoint_log(graph);
+        append_frame(frames, tag, out.str(), FRAME_END);
+    };
+
+    // Perform the deferred commands until one has to wait for the jobs
+    auto drain = [&]()
+    {
+        while (running && !deferred.empty())
+        {
+            const DeferredCommand &next = deferred.front();
+            bool is_job = pending_edges == 0 && runs_as_job(parse_command(next.command).verb);
+            if (!is_job && !jobs.running.empty())
             {
-                // Parse the number of vertices and edges
-                int vertices = stoi(params.substr(0, commaPos));
-                int edges = stoi(params.substr(commaPos + 1));
-                graph->newGraph(vertices, edges); // Create a new graph
+                return;
             }
-            else
+            perform(next.tag, next.command);
+            deferred.pop_front();
+        }
+    };
+
+    // Write the held frames whose records are durable
+    auto release = [&]()
+    {
+        uint64_t durable = wal.durableCount();
+        while (!held.empty() && held.front().record <= durable)
+        {
+            write_all(STDOUT_FILENO, held.front().frames);
+            held.pop_front();
+        }
+    };
+
+    struct pollfd fds[3] = {{STDIN_FILENO, POLLIN, 0}, {jobs.wake_fd, POLLIN, 0}, {wal.wake_fd, POLLIN, 0}};
+    while (running)
+    {
+        if (poll(fds, 3, -1) == -1)
+        {
+            if (errno == EINTR)
             {
-                cout << "Invalid parameters for Newgraph. Please use the format 'Newgraph vertices,edges'." << endl;
+                continue;
             }
+            perror("poll");
+            break;
         }
-        else if (action == "K")
+        if (fds[1].revents & POLLIN)
         {
-            // Perform Kosaraju's algorithm to find SCCs
-            cout << "Kosaraju on the current graph: " << endl;
-            graph->kosaraju();
+            uint64_t count;
+            if (read(jobs.wake_fd, &count, sizeof count) == -1)
+            {
+                perror("read");
+            }
         }
-        else if (action == "Newedge")
+        if (fds[2].revents & POLLIN)
         {
-            size_t commaPos = params.find(',');
-            if (commaPos != string::npos)
+            uint64_t count;
+            if (read(wal.wake_fd, &count, sizeof count) == -1)
             {
-                // Parse the vertices for the new edge
-                int u = stoi(params.substr(0, commaPos));
-                int v = stoi(params.substr(commaPos + 1));
-                graph->newEdge(u, v); // Add a new edge to the graph
+                perror("read");
             }
-            else
+        }
+        if (fds[0].revents & (POLLIN | POLLHUP | POLLERR))
+        {
+            ssize_t nbytes = read(STDIN_FILENO, buf, sizeof buf);
+            if (nbytes <= 0)
             {
-                cout << "Invalid parameters for Newedge. Please use the format 'Newedge u,v'." << endl;
+                break;
             }
+            lines.feed(buf, nbytes, [&](string_view input)
+                       {
+                           RequestTag tag;
+                           string_view command;
+                           uint64_t conn = 0;
+                           if (!running)
+                           {
+                               return;
+                           }
+                           if (input.compare(0, 8, "!closed ") == 0)
+                           {
+                               // The client is gone: nobody waits for its jobs
+                               scan_number(input.substr(8), conn);
+                               jobs.paused.erase(conn);
+                               cancel_jobs_of(conn);
+                               return;
+                           }
+                           if (input.compare(0, 7, "!pause ") == 0)
+                           {
+                               // The client's output backed up: hold its listings
+                               scan_number(input.substr(7), conn);
+                               jobs.paused.insert(conn);
+                               return;
+                           }
+                           if (input.compare(0, 8, "!resume ") == 0)
+                           {
+                               scan_number(input.substr(8), conn);
+                               jobs.paused.erase(conn);
+                               return;
+                           }
+                           if (!parse_request_tag(input, tag, command))
+                           {
+                               cerr << "list: dropping untagged line: " << input << endl;
+                               return;
+                           }
+                           CommandVerb verb = parse_command(command).verb;
+                           if (verb == VERB_JOBS || verb == VERB_CANCEL)
+                           {
+                               perform(tag, command);
+                           }
+                           else if (!deferred.empty() || (!jobs.running.empty() && (pending_edges > 0 || !runs_as_job(verb))))
+                           {
+                               deferred.push_back({tag, string(command)});
+                           }
+                           else
+                           {
+                               perform(tag, command);
+                           }
+                       });
         }
-        else if (action == "Removeedge")
+        pump_jobs(graph, frames);
+        if (jobs.running.empty())
+        {
+            drain();
+        }
+        if (!frames.empty())
+        {
+            held.push_back({wal.appendedCount(), ""});
+            held.back().frames.swap(frames);
+        }
+        release();
+    }
+
+    // Exiting: stop the jobs still running; the pool joins its threads
+    for (auto &entry : jobs.running)
+    {
+        cancel_job(*entry.second);
+    }
+    wal.close();
+    for (const HeldFrames &entry : held)
+    {
+        write_all(STDOUT_FILENO, entry.frames);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    bool framed = false;
+    int threads = max(1u, thread::hardware_concurrency());
+    const char *wal_path = NULL;      // Write-ahead log, off by default
+    double commit_interval_ms = 1;    // Time the log gathers records before a sync
+    int numa_node = -1;               // NUMA node the engine runs on, -1 for any
+    vector<int> job_cpus;             // CPUs of the job threads, one each; empty for any
+    int opt;
+    while ((opt = getopt(argc, argv, "fj:w:c:n:C:H:")) != -1)
+    {
+        switch (opt)
         {
-            size_t commaPos = params.find(',');
-            if (commaPos != string::npos)
+        case 'f':
+            framed = true;
+            break;
+        case 'j':
+            threads = max(1, atoi(optarg));
+            break;
+        case 'w':
+            wal_path = optarg;
+            break;
+        case 'c':
+            commit_interval_ms = max(0.0, atof(optarg));
+            break;
+        case 'n':
+            if (!parse_numa_node(optarg, numa_node))
+            {
+                cerr << "list: bad NUMA node " << optarg << endl;
+                return 1;
+            }
+            break;
+        case 'C':
+            job_cpus = parse_cpu_list(optarg);
+            if (job_cpus.empty())
             {
-                // Parse the vertices for the edge to remove
-                int u = stoi(params.substr(0, commaPos));
-                int v = stoi(params.substr(commaPos + 1));
-                graph->removeEdge(u, v); // Remove an edge from the graph
+                cerr << "list: bad CPU list " << optarg << endl;
+                return 1;
             }
-            else
+            break;
+        case 'H':
+        {
+            HugePageMode mode = parse_huge_page_mode(optarg);
+            if (mode == HUGE_PAGES_COUNT)
             {
-                cout << "Invalid parameters for Removeedge. Please use the format 'Removeedge u,v'." << endl;
+                cerr << "list: unknown huge page mode " << optarg << " (off, thp or explicit)" << endl;
+                return 1;
             }
+            huge_pages().mode = mode;
+            break;
+        }
+        default:
+            cerr << "Usage: " << argv[0] << " [-f] [-j threads] [-w wal_file] [-c commit_interval_ms]"
+                 << " [-n numa_node] [-C job_cpus] [-H off|thp|explicit]" << endl;
+            return 1;
         }
-        else if (action == "end")
+    }
+    // Placed before anything is allocated or started: the graph's storage is
+    // first touched by this thread and the job threads it starts, so with -n
+    // all of it lands on the node whose CPUs traverse it
+    if (numa_node != -1 && !place_on_numa_node(numa_node))
+    {
+        return 1;
+    }
+    Graph *graph = Graph::getInstance(); // Get the singleton instance of the Graph
+    if (wal_path != NULL)
+    {
+        if (!wal.open(wal_path, (uint64_t)(commit_interval_ms * 1000)))
         {
-            // Exit the program
-            exit(0);
+            return 1;
         }
-        else
+        // Rebuild the graph from the log before serving
+        ostringstream ignored;
+        uint64_t replayed = 0;
+        wal.replay([&](const string &command)
+                   {
+                       ignored.str("");
+                       handle_line(graph, command, ignored);
+                       replayed++;
+                   });
+        pending_notes.clear();
+        engine_stats.commands = 0;
+        cerr << "list: replayed " << replayed << " commands from " << wal_path << endl;
+    }
+    if (framed)
+    {
+        run_framed(graph, threads, job_cpus);
+        return 0;
+    }
+    while (true)
+    {
+        if (pending_edges == 0)
+        {
+            cout << "Enter the action that you want to perform:" << '\n';
+        }
+        string input;
+        if (!getline(cin, input)) // Get user input
+        {
+            break;
+        }
+        log_command(graph, input);
+        if (!handle_line(graph, input, cout))
         {
-            cout << "Invalid action. Available actions: Newgraph, K, Newedge, Removeedge, end." << endl;
+            break;
         }
+        checkpoint_log(graph);
+        cout << pending_notes << flush;
+        pending_notes.clear();
     }
     return 0;
 }